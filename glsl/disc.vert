@@ -0,0 +1,21 @@
+#version 120
+
+// Covers the screen's disc, for glsl/tiling.frag to fill in.
+
+// Shader inputs.
+// The corners of the square around the disc.
+attribute vec2 position;
+
+uniform float screen_ratio;
+uniform float screen_zoom;
+
+// Where the fragment is in the screen's disc.
+varying vec2 y;
+
+void main()
+{
+    y = position;
+
+    vec2 u = screen_zoom*y;
+    gl_Position = vec4(u.x/screen_ratio, u.y, 0.0, 1.0);
+}
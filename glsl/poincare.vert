@@ -19,9 +19,10 @@ vec2 cdiv(vec2 a, vec2 b)
     return cmul(a, cconj(b))/len2(b);
 }
 
-vec2 S(vec2 a, vec2 x)
+// The mobius transformation x -> (a x + b)/(conj(b) x + conj(a)).
+vec2 mobius(vec2 a, vec2 b, vec2 x)
 {
-    return cdiv(x + a, vec2(1, 0) + cmul(cconj(a), x));
+    return cdiv(cmul(a, x) + b, cmul(cconj(b), x) + cconj(a));
 }
 
 
@@ -31,11 +32,13 @@ attribute vec2 position;
 
 uniform float screen_ratio;
 uniform float screen_zoom;
-uniform vec2 pan;
+// Carries position to the screen's disc. See poincare::mobius.
+uniform vec2 view_a;
+uniform vec2 view_b;
 
 void main() 
 {
-    vec2 y = S(pan, position);
+    vec2 y = mobius(view_a, view_b, position);
 
     vec2 u = screen_zoom*y;
     gl_Position = vec4(u.x/screen_ratio, u.y, 0.0, 1.0);
@@ -0,0 +1,141 @@
+#version 120
+
+// Draws one segment of a curve per instance, as a cubic spline through the
+// points p1 and p2, which bends to suit the points p0 before it and p3 after
+// it, so that the curve is smooth through every point. See tessellate.hpp.
+
+// Helpers
+float len2(vec2 a)
+{
+    return dot(a, a);
+}
+float cross2(vec2 a, vec2 b)
+{
+    return a.x*b.y - a.y*b.x;
+}
+
+vec2 cconj(vec2 a)
+{
+    return vec2(a.x, -a.y);
+}
+vec2 cmul(vec2 a, vec2 b)
+{
+    return vec2(a.x*b.x - a.y*b.y, a.x*b.y + a.y*b.x);
+}
+vec2 cdiv(vec2 a, vec2 b)
+{
+    return cmul(a, cconj(b))/len2(b);
+}
+
+// The mobius transformation x -> (a x + b)/(conj(b) x + conj(a)).
+vec2 mobius(vec2 a, vec2 b, vec2 x)
+{
+    return cdiv(cmul(a, x) + b, cmul(cconj(b), x) + cconj(a));
+}
+
+// Whether x is a separator rather than a point.
+bool separator(vec2 x)
+{
+    return len2(x) >= 1.0;
+}
+
+
+// Shader inputs.
+// The same for every instance: which vertex of the segment this is. For the
+// cap, corner.x is -1, and corner.y is which corner of the pen (see below).
+// Otherwise, corner.x is the step along the segment, from 0 to SPLINE_STEPS,
+// and corner.y is which side of it, 1 or -1.
+attribute vec2 corner;
+// One per instance: the points around the segment.
+attribute vec2 p0;
+attribute vec2 p1;
+attribute vec2 p2;
+attribute vec2 p3;
+
+uniform float screen_ratio;
+uniform float screen_zoom;
+// Carries the points to the screen's disc. See poincare::mobius.
+uniform vec2 view_a;
+uniform vec2 view_b;
+uniform float line_width;
+uniform float spline_steps;
+// The length of a step along the segment on the screen, as a distance in the
+// screen's disc. Short segments take fewer steps.
+uniform float step_size;
+
+// The pen is a thin parallelogram, at 45 degrees, LINE_WIDTH long, at the
+// centre of the disc. Elsewhere it is shrunk by 1 - |z|^2, as the mouse is.
+vec2 pen(float k)
+{
+    vec2 n = vec2(.35, .35)*line_width;
+    vec2 m = vec2(.05, -.05)*line_width;
+    return k == 0.0? n + m : k == 1.0? n - m : k == 2.0? m - n : -n - m;
+}
+
+// How much the view turns things at the point z, as a complex number of
+// length 1: the argument of the derivative of the view's mobius
+// transformation, which is proportional to 1/(conj(b) z + conj(a))^2. (Its
+// length is (1 - |S(z)|^2)/(1 - |z|^2), which is why the pen can be shrunk by
+// 1 - |z|^2 after the view, rather than before.)
+vec2 turn(vec2 z)
+{
+    vec2 w = cconj(cmul(cconj(view_b), z) + cconj(view_a));
+    return cmul(w, w)/len2(w);
+}
+
+void main()
+{
+    // The centre of the pen, and where this vertex is on the pen.
+    vec2 c, o;
+    if (separator(p1)) {
+        // Nothing to draw.
+        c = o = vec2(0.0);
+    } else if (corner.x < 0.0 || separator(p2)) {
+        // The cap at p1, which is all there is if the curve ends there. The
+        // rest of the vertices collapse onto its last corner.
+        c = p1;
+        o = pen(corner.x < 0.0? corner.y : 3.0);
+    } else {
+        // A centripetal Catmull-Rom spline, which, unlike the usual kind,
+        // doesn't overshoot where short segments meet long ones, as they do
+        // wherever the curve turns sharply. At the ends of the curve, and
+        // wherever two points are the same, the point before or after is
+        // made up, in line with the segment.
+        float d1 = sqrt(length(p2 - p1));
+        vec2 q0 = p0, q3 = p3;
+        if (separator(q0) || q0 == p1)
+            q0 = 2.0*p1 - p2;
+        if (separator(q3) || q3 == p2)
+            q3 = 2.0*p2 - p1;
+        float d0 = sqrt(length(p1 - q0)), d2 = sqrt(length(q3 - p2));
+        vec2 m1 = vec2(0.0), m2 = vec2(0.0);
+        if (d1 > 0.0) {
+            m1 = ((p1 - q0)/d0 - (p2 - q0)/(d0 + d1) + (p2 - p1)/d1)*d1;
+            m2 = ((p2 - p1)/d1 - (q3 - p1)/(d1 + d2) + (q3 - p2)/d2)*d1;
+        }
+
+        vec2 s1 = mobius(view_a, view_b, p1);
+        vec2 s2 = mobius(view_a, view_b, p2);
+        float n = clamp(ceil(length(s2 - s1)/step_size), 1.0, spline_steps);
+        float t = min(corner.x, n)/n;
+        float t2 = t*t, t3 = t2*t;
+        c = (2.0*t3 - 3.0*t2 + 1.0)*p1 + (t3 - 2.0*t2 + t)*m1 +
+            (-2.0*t3 + 3.0*t2)*p2 + (t3 - t2)*m2;
+        vec2 d = (6.0*t2 - 6.0*t)*p1 + (3.0*t2 - 4.0*t + 1.0)*m1 +
+            (-6.0*t2 + 6.0*t)*p2 + (3.0*t2 - 2.0*t)*m2;
+
+        // Sweep the pen along the spline, by the pair of its corners that are
+        // furthest apart across it.
+        vec2 a = pen(0.0), b = pen(1.0);
+        o = corner.y*(abs(cross2(d, a)) > abs(cross2(d, b))? a : b);
+    }
+
+    // Only the centre goes through the view. The pen is put on after, on the
+    // screen, so it is the same width all the way around however strongly
+    // the view bends things there.
+    vec2 y = mobius(view_a, view_b, c);
+    y += cmul(turn(c), o)*(1.0 - len2(y));
+
+    vec2 u = screen_zoom*y;
+    gl_Position = vec4(u.x/screen_ratio, u.y, 0.0, 1.0);
+}
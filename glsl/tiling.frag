@@ -0,0 +1,101 @@
+#version 120
+
+// Draws the {p, q} tiling one pixel at a time, rather than from a mesh. The
+// tiling is symmetric under reflection in every edge of every polygon, and
+// every line through the centre of a polygon and one of its vertices or edge
+// midpoints, and those lines cut each polygon up into 2q triangles, each of
+// which is just like every other. So each pixel's point of the board is
+// folded by those reflections into the triangle between the middle of the
+// reference polygon, vertex 0 and the midpoint of edge q - 1, where the only
+// edge is the one the triangle's on, and how far the point is from that edge
+// is how far it is from any edge. However deep into the tiling the pixel is,
+// that is the only thing the colour depends on.
+
+// Helpers
+float len2(vec2 a)
+{
+    return dot(a, a);
+}
+
+vec2 cconj(vec2 a)
+{
+    return vec2(a.x, -a.y);
+}
+vec2 cmul(vec2 a, vec2 b)
+{
+    return vec2(a.x*b.x - a.y*b.y, a.x*b.y + a.y*b.x);
+}
+vec2 cdiv(vec2 a, vec2 b)
+{
+    return cmul(a, cconj(b))/len2(b);
+}
+
+// The mobius transformation x -> (a x + b)/(conj(b) x + conj(a)).
+vec2 mobius(vec2 a, vec2 b, vec2 x)
+{
+    return cdiv(cmul(a, x) + b, cmul(cconj(b), x) + cconj(a));
+}
+
+
+// Points that take more folds than this to get into the triangle are so far
+// out that the polygons there are well under a pixel.
+#define MAX_FOLDS 64
+
+// Shader inputs.
+varying vec2 y;
+
+// Carries the screen's disc to the tiling's. See poincare::mobius.
+uniform vec2 view_a;
+uniform vec2 view_b;
+// The angle each edge of a polygon takes up about its centre, and the edge
+// of the triangle, which is an arc of the circle about edge_centre of radius
+// edge_radius.
+uniform float phi;
+uniform vec2 edge_centre;
+uniform float edge_radius;
+// The size of a pixel in the screen's disc, and how far across the polygons'
+// inscribed circles are, in the hyperbolic metric.
+uniform float pixel_size;
+uniform float polygon_size;
+uniform vec4 colour;
+
+void main()
+{
+    float s = len2(y);
+    if (s >= 1.0)
+        discard;
+    // How much the disc shrinks things at y.
+    float scale = (1.0 - s)/2.0;
+
+    vec2 z = mobius(view_a, view_b, y);
+    float r2 = edge_radius*edge_radius;
+    bool folded = false;
+    for (int i = 0; i < MAX_FOLDS; i++) {
+        // Into the wedge between vertex 0 and edge q - 1's midpoint.
+        float t = atan(z.y, z.x);
+        t = abs(mod(t + phi/2.0, phi) - phi/2.0);
+        z = length(z)*vec2(cos(t), sin(t));
+        // Out of the neighbouring polygon, if it's in it.
+        vec2 w = z - edge_centre;
+        if (len2(w) >= r2) {
+            folded = true;
+            break;
+        }
+        z = edge_centre + r2*w/len2(w);
+    }
+
+    // How much of the pixel the nearest edge covers, give or take, which is
+    // about one line's worth for every polygon across, where they are smaller
+    // than a pixel.
+    float pixels = polygon_size*scale/pixel_size;
+    float average = min(1.0/pixels, 1.0);
+    float cover = average;
+    if (folded) {
+        // sinh of the distance from the edge, which is near enough to the
+        // distance itself where it counts.
+        float d = (len2(z - edge_centre) - r2)/(edge_radius*(1.0 - len2(z)));
+        cover = clamp(1.0 - d*scale/pixel_size, 0.0, 1.0);
+        cover = mix(average, cover, clamp(pixels - 1.0, 0.0, 1.0));
+    }
+    gl_FragColor = vec4(cover*colour.rgb, colour.a);
+}
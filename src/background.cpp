@@ -0,0 +1,129 @@
+// vi:fo=qacj com=b\://
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "background.hpp"
+#include "lazy_tiling.hpp"
+
+
+namespace background {
+
+// The worker checks whether it has been cancelled every so many polygons, a
+// fraction of a millisecond's worth.
+#define CHECK_POLYGONS 64
+
+struct order {
+    unsigned p, q, res;
+    poincare::mobius view;
+    double pixel;
+};
+
+// The worker, and what it shares with the render thread. Requests are
+// numbered from 1; g_asked is the last one, and g_made the one whose mesh is
+// in g_mesh, or 0 if there isn't one. g_asked is atomic so that the worker
+// can see that it has been cancelled without taking the lock.
+static thread g_worker;
+static mutex g_lock;
+static condition_variable g_wake, g_done;
+static order g_order;
+static atomic<unsigned> g_asked(0);
+static unsigned g_made = 0, g_collected = 0;
+static mesh g_mesh;
+static atomic<bool> g_stop(false);
+static void (*g_ready)(void);
+
+
+// Make the mesh for each request as it comes in, unless another comes in
+// first.
+static void worker(void)
+{
+    poincare::lazy_tiling l;
+    unique_lock<mutex> lock(g_lock);
+    unsigned n = 0;
+    for (;;) {
+        g_wake.wait(lock, [&] { return g_asked != n || g_stop; });
+        if (g_stop)
+            return;
+        n = g_asked;
+        order o = g_order;
+        lock.unlock();
+
+        mesh m;
+        poincare::start_tiling(&l, o.p, o.q, o.res, o.view, o.pixel);
+        bool cancelled = false;
+        while (!poincare::continue_tiling(&l, CHECK_POLYGONS, &m.points)) {
+            if (g_asked != n || g_stop) {
+                cancelled = true;
+                break;
+            }
+        }
+        m.origin = l.origin;
+        m.centre = image(inverse(l.view), complex<double>(0));
+
+        lock.lock();
+        if (!cancelled && g_asked == n) {
+            g_mesh = move(m);
+            g_made = n;
+            g_done.notify_all();
+            lock.unlock();
+            if (g_ready != NULL)
+                g_ready();
+            lock.lock();
+        }
+    }
+}
+
+// Start the worker. It calls ready, if it isn't NULL, whenever a mesh is
+// ready to be collected.
+void start(void (*ready)(void))
+{
+    g_ready = ready;
+    g_stop = false;
+    g_worker = thread(worker);
+}
+
+// Ask for the {p, q} tiling with res points to each edge, around view, down
+// to polygons of pixel across. See poincare::start_tiling().
+void request(unsigned p, unsigned q, unsigned res, const poincare::mobius &view,
+        double pixel)
+{
+    lock_guard<mutex> lock(g_lock);
+    g_order = {p, q, res, view, pixel};
+    g_asked++;
+    g_wake.notify_one();
+}
+
+// If the mesh for the last request is ready, and hasn't been collected yet,
+// put it in *m and return true. If wait, and it has been asked for, wait for
+// it to be ready first.
+bool collect(bool wait, mesh *m)
+{
+    unique_lock<mutex> lock(g_lock);
+    if (g_collected == g_asked)
+        return false;
+    if (wait)
+        g_done.wait(lock, [] { return g_made == g_asked; });
+    if (g_made != g_asked)
+        return false;
+    *m = move(g_mesh);
+    g_collected = g_made;
+    return true;
+}
+
+// Stop the worker, and throw away whatever it is making.
+void stop(void)
+{
+    {
+        lock_guard<mutex> lock(g_lock);
+        g_stop = true;
+        g_wake.notify_one();
+    }
+    g_worker.join();
+}
+
+}
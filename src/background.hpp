@@ -0,0 +1,35 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include "poincare.hpp"
+
+// Making the background mesh on a thread of its own, so that however long it
+// takes, no frame ever waits for it. The render thread asks for a mesh with
+// request(), and keeps drawing the one it has until collect() hands it the new
+// one, which it uploads and swaps in. Asking again before then cancels the
+// last request, wherever the worker is with it, so that pressing keys over and
+// over never queues up meshes that would only be thrown away. See
+// lazy_tiling.hpp for the meshes themselves.
+
+namespace background {
+
+// A mesh, in the coordinates of the polygon that the view centre was in,
+// which origin carries to the coordinates of the tiling that the view was of.
+// centre is where the view centre was, in the mesh's coordinates.
+struct mesh {
+    std::vector<std::complex<float>> points;
+    poincare::mobius origin;
+    std::complex<double> centre;
+};
+
+void start(void (*ready)(void));
+void request(unsigned p, unsigned q, unsigned res, const poincare::mobius &view,
+        double pixel);
+bool collect(bool wait, mesh *m);
+void stop(void);
+
+}
@@ -0,0 +1,71 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <atomic>
+#include <vector>
+
+#include "helpers.hpp"
+
+#include "background.hpp"
+#include "lazy_tiling.hpp"
+#include "poincare.hpp"
+
+using namespace std;
+
+// Check that the worker makes the same mesh as a lazy tiling made right here,
+// that only the last of a run of requests gets a mesh, and that there is
+// nothing to collect when nothing has been asked for.
+
+static atomic<unsigned> g_readies(0);
+static void ready(void)
+{
+    g_readies++;
+}
+
+static void check(unsigned p, unsigned q, unsigned res,
+        const poincare::mobius &view, double pixel, const background::mesh &m)
+{
+    poincare::lazy_tiling l;
+    vector<complex<float>> y;
+    poincare::start_tiling(&l, p, q, res, view, pixel);
+    poincare::continue_tiling(&l, ~0u, &y);
+    printf("{%u, %u}, res %u: %zu vertices, %s\n", p, q, res, m.points.size(),
+            m.points == y? "ok" : "MISMATCH");
+    assert(m.points == y);
+    assert(m.origin.a == l.origin.a && m.origin.b == l.origin.b);
+}
+
+int main(int argc, const char **argv)
+{
+    double pixel = 1./700;
+    poincare::mobius far = compose(poincare::rotation(polar(1., 2.)),
+            poincare::translation(-.99));
+    background::mesh m;
+    background::start(ready);
+
+    assert(!background::collect(false, &m));
+    assert(!background::collect(true, &m));
+
+    background::request(3, 7, 5, poincare::identity(), pixel);
+    assert(background::collect(true, &m));
+    check(3, 7, 5, poincare::identity(), pixel, m);
+    assert(g_readies == 1);
+    // It has been collected, so there is nothing left to.
+    assert(!background::collect(true, &m));
+
+    // Only the last of these is any use, and it is the one that comes out,
+    // however many of the others the worker got around to starting.
+    unsigned pq[][2] = {{4, 5}, {7, 3}, {5, 6}, {3, 8}};
+    for (auto& t : pq)
+        background::request(t[0], t[1], 5, far, pixel);
+    assert(background::collect(true, &m));
+    check(3, 8, 5, far, pixel, m);
+    assert(!background::collect(false, &m));
+
+    // A request that is never collected doesn't hold up stop().
+    background::request(3, 7, 20, poincare::identity(), pixel/10);
+    background::stop();
+    return 0;
+}
@@ -0,0 +1,338 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <complex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "helpers.hpp"
+
+#include "lazy_tiling.hpp"
+#include "poincare.hpp"
+#include "tessellate.hpp"
+#include "tiles.hpp"
+
+// Time the expensive things that don't need a window: generating tilings,
+// whole or around a view, line_strip_to_lines(), tessellating the foreground,
+// both from scratch as refresh_foreground() does and a point at a time as
+// grow_foreground() does, and finding the curves under the eraser.
+// The results go to stdout (or the file named by the first argument) as JSON,
+// so that runs from different commits can be diffed. Progress goes to stderr.
+//
+// Every case runs in its own process, so that the peak memory use reported for
+// it is its own.
+
+// Run each case for at least this long, and at least MIN_CALLS times.
+#define MIN_TIME .25
+#define MIN_CALLS 3
+
+struct result {
+    unsigned calls;
+    double mean, best;  // seconds per call
+    double verts;  // vertices made per call
+};
+
+static double now(void)
+{
+    return chrono::duration<double>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Call f, which returns how many vertices it made, over and over.
+template<typename F> static result time_calls(F f)
+{
+    result r = {0, 0, 1e300, 0};
+    double t_start = now();
+    for (;;) {
+        double t0 = now();
+        r.verts = f();
+        double t = now() - t0;
+        r.calls++;
+        r.best = min(r.best, t);
+        if (r.calls >= MIN_CALLS && now() - t_start >= MIN_TIME)
+            break;
+    }
+    r.mean = (now() - t_start)/r.calls;
+    return r;
+}
+
+
+static unsigned bench_tiling(unsigned p, unsigned q, unsigned res,
+        unsigned niter)
+{
+    complex<float> *y;
+    unsigned ny;
+    poincare::tiling(p, q, res, niter, &y, &ny);
+    free(y);
+    return ny;
+}
+
+// The whole of a lazy tiling, down to polygons of pixel across.
+static unsigned bench_lazy_tiling(unsigned p, unsigned q, unsigned res,
+        double pixel)
+{
+    poincare::lazy_tiling l;
+    vector<complex<float>> y;
+    poincare::start_tiling(&l, p, q, res, poincare::identity(), pixel);
+    poincare::continue_tiling(&l, ~0u, &y);
+    return y.size();
+}
+
+static unsigned bench_line_strip(const complex<float> *x, unsigned n)
+{
+    complex<float> *y;
+    unsigned ny;
+    // line_strip_to_lines() doesn't write to x.
+    line_strip_to_lines((complex<float> *)x, n, &y, &ny);
+    free(y);
+    return ny;
+}
+
+// A board of ncurves random wiggly curves of npoints points each, all in the
+// one tile, laid out as in struct tiles::tile.
+struct board {
+    vector<complex<float>> points;
+    vector<unsigned> starts;
+};
+static board synthetic_board(unsigned ncurves, unsigned npoints)
+{
+    srand48(1);
+    board b;
+    b.starts.push_back(0);
+    for (unsigned c = 0; c < ncurves; c++) {
+        complex<float> z = polar((float)(.5*drand48()), (float)(TAU*drand48()));
+        float heading = TAU*drand48();
+        for (unsigned i = 0; i < npoints; i++) {
+            b.points.push_back(z);
+            heading += .5*(drand48() - .5);
+            z += polar(.003f, heading);
+            if (abs(z) > .6f)
+                z *= .6f/abs(z);
+        }
+        b.starts.push_back(b.points.size());
+    }
+    return b;
+}
+
+static unsigned bench_refresh(const board &b)
+{
+    vector<complex<float>> rendered;
+    tessellate_curves(b.points.data(), b.starts.data(), b.starts.size() - 1,
+            &rendered);
+    return rendered.size();
+}
+
+// Draw the board point by point, like grow_foreground(), into vbo, which is
+// big enough.
+static unsigned bench_grow(const board &b, vector<complex<float>> *vbo)
+{
+    // The strip starts with a separator, as the first chunk of a tile does.
+    (*vbo)[0] = SEPARATOR;
+    unsigned len = 1;
+    unsigned nmade = 0;
+    vector<complex<float>> y;
+    for (unsigned c = 0; c + 1 < b.starts.size(); c++) {
+        const complex<float> *curve = &b.points[b.starts[c]];
+        for (unsigned N = 1; N <= b.starts[c + 1] - b.starts[c]; N++) {
+            len -= tessellate_tail(curve, N, N - 1, N - 1, &y);
+            COPY_ARRAY(y.data(), &(*vbo)[len], y.size());
+            len += y.size();
+            nmade += y.size();
+        }
+    }
+    assert(len == vbo->size());
+    return nmade;
+}
+
+// Look for the curves under ERASE_QUERIES short random eraser strokes, as
+// erase_along() does, in a tile holding the whole board. Return how many
+// lookups were done, rather than vertices made.
+#define ERASE_QUERIES 1000
+static unsigned bench_erase(tiles::tile *t)
+{
+    vector<unsigned> hits;
+    for (unsigned i = 0; i < ERASE_QUERIES; i++) {
+        complex<float> a = polar(.6f*(float)sqrt(drand48()),
+                (float)(TAU*drand48()));
+        complex<float> b = a + polar(.01f, (float)(TAU*drand48()));
+        hits.clear();
+        tiles::curves_near(t, a, b, LINE_WIDTH, &hits);
+    }
+    return ERASE_QUERIES;
+}
+
+// Make the foreground of a tile holding the whole board at the finest level of
+// detail that is simplified, as refresh_lod() does.
+#define LOD_TOLERANCE .004
+static unsigned bench_lod(const tiles::tile *t)
+{
+    vector<complex<float>> points;
+    vector<unsigned> starts;
+    tiles::simplify(t, LOD_TOLERANCE, LINE_WIDTH, &points, &starts);
+    vector<complex<float>> rendered;
+    tessellate_curves(points.data(), starts.data(), starts.size() - 1,
+            &rendered);
+    return rendered.size();
+}
+
+
+struct bench_case {
+    string name;
+    string params;  // JSON members describing the case
+    function<result(void)> run;
+};
+
+// Run c in a child process, and return a JSON object describing how it went.
+static string run_case(const bench_case &c)
+{
+    fprintf(stderr, "%s %s\n", c.name.c_str(), c.params.c_str());
+    int fd[2];
+    int res_pipe = pipe(fd);
+    assert(res_pipe == 0);
+
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        close(fd[0]);
+        result r = c.run();
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        char buf[1024];
+        int n = snprintf(buf, sizeof(buf),
+                "{\"bench\": \"%s\", %s, \"calls\": %u, "
+                "\"s_per_call\": %.9g, \"best_s_per_call\": %.9g, "
+                "\"verts_per_call\": %.0f, \"verts_per_s\": %.6g, "
+                "\"peak_rss_kib\": %ld}",
+                c.name.c_str(), c.params.c_str(), r.calls, r.mean, r.best,
+                r.verts, r.verts/r.mean, ru.ru_maxrss);
+        ssize_t res_write = write(fd[1], buf, n);
+        assert(res_write == n);
+        _exit(0);
+    }
+
+    close(fd[1]);
+    string out;
+    char buf[1024];
+    ssize_t n;
+    while ((n = read(fd[0], buf, sizeof(buf))) > 0)
+        out.append(buf, n);
+    close(fd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return out;
+}
+
+int main(int argc, const char **argv)
+{
+    FILE *f = stdout;
+    if (argc > 1) {
+        f = fopen(argv[1], "w");
+        assert(f != NULL);
+    }
+
+    vector<bench_case> cases;
+    char params[256];
+
+    // Tilings, around the default of {3, 7}, res 5, niter 5.
+    unsigned tilings[][4] = {
+        {3, 7, 5, 3}, {3, 7, 5, 4}, {3, 7, 5, 5}, {3, 7, 5, 6}, {3, 7, 5, 7},
+        {3, 7, 2, 5}, {3, 7, 10, 5}, {3, 7, 20, 5},
+        {3, 8, 4, 6}, {4, 5, 5, 5}, {5, 4, 3, 5}, {4, 6, 3, 4},
+        {7, 3, 5, 6}, {8, 3, 3, 6},
+    };
+    for (auto& t : tilings) {
+        unsigned p = t[0], q = t[1], res = t[2], niter = t[3];
+        snprintf(params, sizeof(params),
+                "\"p\": %u, \"q\": %u, \"res\": %u, \"niter\": %u",
+                p, q, res, niter);
+        cases.push_back({"tiling", params, [=]{
+            return time_calls([=]{ return bench_tiling(p, q, res, niter); });
+        }});
+    }
+
+    // Lazy tilings, at the resolution they are made at on the screen, and
+    // finer.
+    unsigned lazy_tilings[][3] = {{3, 7, 5}, {4, 5, 5}, {7, 3, 5}};
+    for (auto& t : lazy_tilings) {
+        unsigned p = t[0], q = t[1], res = t[2];
+        for (double pixel : {1./700, 1./7000}) {
+            snprintf(params, sizeof(params),
+                    "\"p\": %u, \"q\": %u, \"res\": %u, \"pixel\": %g",
+                    p, q, res, pixel);
+            cases.push_back({"lazy_tiling", params, [=]{
+                return time_calls([=]{
+                    return bench_lazy_tiling(p, q, res, pixel);
+                });
+            }});
+        }
+    }
+
+    for (unsigned n : {16u, 1024u, 65536u, 1048576u}) {
+        snprintf(params, sizeof(params), "\"n\": %u", n);
+        cases.push_back({"line_strip_to_lines", params, [=]{
+            complex<float> *x = linspacecf(0.f, 1.f + 1if, n);
+            result r = time_calls([=]{ return bench_line_strip(x, n); });
+            free(x);
+            return r;
+        }});
+    }
+
+    // Boards: curves x points per curve.
+    unsigned boards[][2] = {
+        {1, 100}, {10, 100}, {100, 100}, {1000, 100}, {100, 1000},
+    };
+    for (auto& b : boards) {
+        unsigned ncurves = b[0], npoints = b[1];
+        snprintf(params, sizeof(params), "\"curves\": %u, \"points\": %u",
+                ncurves, npoints);
+        cases.push_back({"refresh_foreground", params, [=]{
+            board b = synthetic_board(ncurves, npoints);
+            return time_calls([&]{ return bench_refresh(b); });
+        }});
+        cases.push_back({"grow_foreground", params, [=]{
+            board b = synthetic_board(ncurves, npoints);
+            vector<complex<float>> vbo(bench_refresh(b));
+            return time_calls([&]{ return bench_grow(b, &vbo); });
+        }});
+        cases.push_back({"erase", params, [=]{
+            board b = synthetic_board(ncurves, npoints);
+            tiles::tile *t = tiles::origin();
+            tiles::map_curves(t, b.points.data(), b.starts.data(), ncurves,
+                    0, 2*atanh(.6f), NULL);
+            return time_calls([&]{ return bench_erase(t); });
+        }});
+        cases.push_back({"refresh_lod", params, [=]{
+            board b = synthetic_board(ncurves, npoints);
+            tiles::tile *t = tiles::origin();
+            tiles::map_curves(t, b.points.data(), b.starts.data(), ncurves,
+                    0, 2*atanh(.6f), NULL);
+            return time_calls([&]{ return bench_lod(t); });
+        }});
+    }
+
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"simd\": \"%s\",\n", poincare::simd_isa());
+    fprintf(f, "  \"cores\": %u,\n", thread::hardware_concurrency());
+    fprintf(f, "  \"results\": [\n");
+    for (unsigned i = 0; i < cases.size(); i++) {
+        fprintf(f, "    %s%s\n", run_case(cases[i]).c_str(),
+                i + 1 < cases.size()? "," : "");
+        fflush(f);
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout)
+        fclose(f);
+    return 0;
+}
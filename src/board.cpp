@@ -0,0 +1,446 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <complex>
+#include <map>
+#include <set>
+#include <vector>
+using namespace std;
+
+#include "helpers.hpp"
+
+#include "board.hpp"
+
+
+// A board file is laid out so that it can be mmapped and used as is: loading
+// one doesn't read the points at all, it just points the tiles at them (see
+// tiles::map_curves()), and they get paged in as the tiles come into view and
+// are tessellated. Everything is in native byte order, and every array is
+// aligned to 8 bytes.
+//
+//  board_header
+//  board_tile[ntiles]
+//  for each tile: complex<float> points[npoints]
+//  for each tile: uint32_t starts[ncurves + nundone + 1], padded to 8 bytes
+//  uint32_t history[nhistory], indices into the tiles
+//  uint32_t redo[the sum of the tiles' nundone], indices into the tiles
+//  for each tile, and then the view tile: uint8_t path[path_length]
+//
+// Each tile's curves are laid out as in struct tiles::tile, undone ones and
+// all, and history and redo are as in struct board_state, so that a curve
+// undone before a save can still be redone after it. A tile's path is its
+// path from the origin, as tiles::path() makes.
+
+struct board_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t ntiles;
+    uint32_t nhistory;
+    uint32_t generation;  // of the journal that continues it; see journal.hpp
+    uint32_t view_tile_length, unused;
+    uint64_t view_tile_offset;  // of the view tile's path
+    double view[4];
+    double background_view[4];
+    uint64_t history_offset;
+};
+static_assert(sizeof(board_header) == 112, "board_header is not 112 bytes");
+
+struct board_tile {
+    uint64_t path_offset;
+    uint32_t path_length, unused;
+    uint64_t points_offset, starts_offset;
+    uint32_t npoints, ncurves;
+    float radius;
+    uint32_t nundone;
+};
+static_assert(sizeof(board_tile) == 48, "board_tile is not 48 bytes");
+
+#define BOARD_MAGIC "ibboard"
+#define BOARD_VERSION 2
+
+static void put_mobius(double *x, const poincare::mobius &f)
+{
+    x[0] = real(f.a);
+    x[1] = imag(f.a);
+    x[2] = real(f.b);
+    x[3] = imag(f.b);
+}
+static poincare::mobius get_mobius(const double *x)
+{
+    return {complex<double>(x[0], x[1]), complex<double>(x[2], x[3])};
+}
+
+static uint64_t align8(uint64_t x)
+{
+    return (x + 7) & ~(uint64_t)7;
+}
+
+
+// Take t's curve i out of history, which is the tile of every curve, in the
+// order they were drawn, as in struct board_state.
+static void forget_curve(vector<tiles::tile *> *history, tiles::tile *t,
+        unsigned i)
+{
+    // t's curves are in history in the same order as they are in t.
+    for (auto it = history->begin(); it != history->end(); it++) {
+        if (*it == t && i-- == 0) {
+            history->erase(it);
+            return;
+        }
+    }
+    assert(false);
+}
+
+// Erase t's curve i for good, and take it out of history.
+void erase_curve(vector<tiles::tile *> *history, tiles::tile *t, unsigned i)
+{
+    tiles::remove_curves(t, {i});
+    forget_curve(history, t, i);
+}
+// Cut whatever is inside d out of t's curves cs, as tiles::clip_curves() does.
+// What is left of them is drawn anew, as far as history is concerned, so that
+// t's curves stay in the same order in both.
+bool clip_curves(vector<tiles::tile *> *history, tiles::tile *t,
+        vector<unsigned> *cs, tiles::disc d)
+{
+    unsigned n = t->ncurves;
+    if (!tiles::clip_curves(t, cs, d))
+        return false;
+    for (unsigned k = cs->size(); k-- > 0; )
+        forget_curve(history, t, (*cs)[k]);
+    history->insert(history->end(), t->ncurves - (n - cs->size()), t);
+    return true;
+}
+
+
+// Copy what save_snapshot() needs of the board. Tiles whose curves are still
+// in the mapping of a board file are shared with it, since that never changes,
+// so this only copies the curves of the tiles that have changed since they
+// were loaded, or since the last remap_board().
+board_snapshot snapshot_board(const board_state &b)
+{
+    board_snapshot s;
+    map<tiles::tile *, uint32_t> index;
+    for (tiles::tile *t : tiles::inked()) {
+        unsigned n = t->ncurves + t->nundone;
+        if (n == 0)
+            continue;
+        index[t] = s.tiles.size();
+        s.tiles.emplace_back();
+        snapshot_tile &e = s.tiles.back();
+        e.t = t;
+        tiles::path(t, &e.path);
+        e.ncurves = t->ncurves;
+        e.nundone = t->nundone;
+        e.version = t->version;
+        e.radius = t->radius;
+        e.mapped = t->starts != t->own_starts.data();
+        if (e.mapped) {
+            e.points = t->points;
+            e.starts = t->starts;
+            e.mapping = t->mapping;
+        } else {
+            e.own_points.assign(t->points, t->points + t->starts[n]);
+            e.own_starts.assign(t->starts, t->starts + n + 1);
+        }
+    }
+    for (tiles::tile *t : b.history)
+        s.history.push_back(index.at(t));
+    for (tiles::tile *t : b.redo)
+        s.redo.push_back(index.at(t));
+    tiles::path(b.view_tile, &s.view_tile);
+    s.view = b.view;
+    s.background_view = b.background_view;
+    s.generation = b.generation;
+    return s;
+}
+static const complex<float> *points_of(const snapshot_tile &e)
+{
+    return e.mapped? e.points : e.own_points.data();
+}
+static const unsigned *starts_of(const snapshot_tile &e)
+{
+    return e.mapped? e.starts : e.own_starts.data();
+}
+
+// Lay s out as a board file, in *h and *bts, and return how big it is.
+static uint64_t layout(const board_snapshot &s, board_header *h,
+        vector<board_tile> *bts)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, BOARD_MAGIC, sizeof(h->magic));
+    h->version = BOARD_VERSION;
+    h->ntiles = s.tiles.size();
+    h->nhistory = s.history.size();
+    h->generation = s.generation;
+    put_mobius(h->view, s.view);
+    put_mobius(h->background_view, s.background_view);
+
+    bts->resize(s.tiles.size());
+    uint64_t pos = sizeof(*h) + s.tiles.size()*sizeof(board_tile);
+    for (unsigned i = 0; i < s.tiles.size(); i++) {
+        const snapshot_tile &e = s.tiles[i];
+        board_tile &bt = (*bts)[i];
+        memset(&bt, 0, sizeof(bt));
+        bt.path_length = e.path.size();
+        bt.npoints = starts_of(e)[e.ncurves + e.nundone];
+        bt.ncurves = e.ncurves;
+        bt.nundone = e.nundone;
+        bt.radius = e.radius;
+        bt.points_offset = pos;
+        pos += bt.npoints*sizeof(complex<float>);
+    }
+    for (board_tile &bt : *bts) {
+        bt.starts_offset = pos;
+        pos = align8(pos + (bt.ncurves + bt.nundone + 1)*sizeof(uint32_t));
+    }
+    h->history_offset = pos;
+    pos += (s.history.size() + s.redo.size())*sizeof(uint32_t);
+    for (board_tile &bt : *bts) {
+        bt.path_offset = pos;
+        pos += bt.path_length;
+    }
+    h->view_tile_offset = pos;
+    h->view_tile_length = s.view_tile.size();
+    return pos + h->view_tile_length;
+}
+
+// Write the board to fn, as save_board() does, from a snapshot of it. This
+// doesn't touch the tiles, so it can be done on any thread.
+bool save_snapshot(const char *fn, const board_snapshot &s)
+{
+    board_header h;
+    vector<board_tile> bts;
+    layout(s, &h, &bts);
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", fn, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = ok && fwrite(bts.data(), sizeof(board_tile), bts.size(), f) ==
+        bts.size();
+    for (unsigned i = 0; ok && i < bts.size(); i++) {
+        ok = fwrite(points_of(s.tiles[i]), sizeof(complex<float>),
+                bts[i].npoints, f) == bts[i].npoints;
+    }
+    static const char zeros[8] = {0};
+    for (unsigned i = 0; ok && i < bts.size(); i++) {
+        unsigned n = bts[i].ncurves + bts[i].nundone + 1;
+        ok = fwrite(starts_of(s.tiles[i]), sizeof(uint32_t), n, f) == n;
+        size_t pad = align8(n*sizeof(uint32_t)) - n*sizeof(uint32_t);
+        ok = ok && fwrite(zeros, 1, pad, f) == pad;
+    }
+    ok = ok && fwrite(s.history.data(), sizeof(uint32_t), s.history.size(),
+            f) == s.history.size();
+    ok = ok && fwrite(s.redo.data(), sizeof(uint32_t), s.redo.size(), f) ==
+        s.redo.size();
+    for (unsigned i = 0; ok && i < s.tiles.size(); i++) {
+        const vector<uint8_t> &p = s.tiles[i].path;
+        ok = fwrite(p.data(), 1, p.size(), f) == p.size();
+    }
+    ok = ok && fwrite(s.view_tile.data(), 1, s.view_tile.size(), f) ==
+        s.view_tile.size();
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        ok = rename(tmp, fn) == 0;
+    if (!ok)
+        unlink(tmp);
+    return ok;
+}
+
+// Write the board to fn. Write to a temporary file first and rename it into
+// place, so that a crash never leaves half a board behind, and so that a board
+// that is currently mapped is never written over.
+bool save_board(const char *fn, const board_state &b)
+{
+    return save_snapshot(fn, snapshot_board(b));
+}
+
+// Map all size bytes of the file open on fd, and return what keeps it mapped,
+// or NULL if it can't be. It is unmapped when the last copy of that goes,
+// which is once nothing has its curves in it any more: no tile, and no
+// snapshot that is being saved from it.
+static shared_ptr<const void> map_file(int fd, size_t size)
+{
+    void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+    return shared_ptr<const void>(m, [size](const void *m) {
+        munmap((void *)m, size);
+    });
+}
+
+// Once s has been saved to fn, point the tiles that haven't changed since at
+// their curves in fn, instead of at copies of their own, or at an older board
+// file, as if they had just been loaded from it, so that the next snapshot
+// doesn't have to copy them again, and so that the older files, which have
+// been renamed over, get unmapped. Nothing is read from fn but its header.
+void remap_board(const char *fn, const board_snapshot &s)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    int res_stat = fstat(fd, &st);
+    assert(res_stat == 0);
+    shared_ptr<const void> m = map_file(fd, st.st_size);
+    close(fd);
+    if (m == NULL)
+        return;
+    const char *base = (const char *)m.get();
+    board_header h;
+    vector<board_tile> bts;
+    uint64_t size = layout(s, &h, &bts);
+    // It's the file s was saved to, unless something else has written over
+    // it since.
+    if ((uint64_t)st.st_size != size ||
+            memcmp(base, &h, sizeof(h)) != 0)
+        return;
+    for (unsigned i = 0; i < s.tiles.size(); i++) {
+        const snapshot_tile &e = s.tiles[i];
+        tiles::tile *t = e.t;
+        if (t->version == e.version && t->ncurves == e.ncurves &&
+                t->nundone == e.nundone) {
+            tiles::rebase(t, (const complex<float> *)(base +
+                        bts[i].points_offset),
+                    (const unsigned *)(base + bts[i].starts_offset), m);
+        }
+    }
+}
+
+
+// Whether the size bytes at offset off of a file of file_size bytes are all
+// in the file, and are aligned to align bytes.
+static bool in_file(uint64_t off, uint64_t size, uint64_t file_size,
+        uint64_t align)
+{
+    return off % align == 0 && off <= file_size && size <= file_size - off;
+}
+
+// The tile whose path is the n bytes at offset off of a board file of
+// file_size bytes mapped at base, or NULL if there isn't one.
+static tiles::tile *find_tile(const char *base, uint64_t file_size,
+        uint64_t off, uint32_t n)
+{
+    if (!in_file(off, n, file_size, 1))
+        return NULL;
+    return tiles::find((const uint8_t *)(base + off), n);
+}
+
+// Load the board in fn into the tiles, which must not have been drawn in yet,
+// and set *b from it. Return false, and change nothing, if fn isn't a board
+// file.
+bool load_board(const char *fn, board_state *b)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    int res_stat = fstat(fd, &st);
+    assert(res_stat == 0);
+    uint64_t size = st.st_size;
+    if (size < sizeof(board_header)) {
+        close(fd);
+        return false;
+    }
+    shared_ptr<const void> m = map_file(fd, size);
+    close(fd);
+    if (m == NULL)
+        return false;
+    const char *base = (const char *)m.get();
+
+    // Check everything before touching the tiles. This reads the header,
+    // the tile table, and the starts, but not the points.
+    const board_header *h = (const board_header *)base;
+    const board_tile *bts = (const board_tile *)(h + 1);
+    bool ok = memcmp(h->magic, BOARD_MAGIC, sizeof(h->magic)) == 0 &&
+        h->version == BOARD_VERSION &&
+        in_file(sizeof(*h), (uint64_t)h->ntiles*sizeof(board_tile), size, 8) &&
+        in_file(h->history_offset, (uint64_t)h->nhistory*sizeof(uint32_t),
+                size, 4);
+    uint64_t nredo = 0;
+    for (unsigned i = 0; ok && i < h->ntiles; i++) {
+        const board_tile &bt = bts[i];
+        uint64_t n = (uint64_t)bt.ncurves + bt.nundone;
+        ok = n > 0 && n < UINT_MAX &&
+            in_file(bt.points_offset,
+                    (uint64_t)bt.npoints*sizeof(complex<float>), size, 8) &&
+            in_file(bt.starts_offset, (n + 1)*sizeof(uint32_t), size, 4);
+        if (!ok)
+            break;
+        // Every curve has at least one point.
+        const uint32_t *starts = (const uint32_t *)(base + bt.starts_offset);
+        ok = starts[0] == 0 && starts[n] == bt.npoints;
+        for (unsigned c = 0; ok && c < n; c++)
+            ok = starts[c] < starts[c + 1];
+        nredo += bt.nundone;
+    }
+    uint64_t redo_offset = h->history_offset +
+        (uint64_t)h->nhistory*sizeof(uint32_t);
+    ok = ok && in_file(redo_offset, nredo*sizeof(uint32_t), size, 4);
+    // Every curve of every tile is in history once, and every undone one in
+    // redo, and nothing else is.
+    const uint32_t *history = (const uint32_t *)(base + h->history_offset);
+    const uint32_t *redo = (const uint32_t *)(base + redo_offset);
+    vector<uint32_t> counts(ok? h->ntiles : 0), undone(ok? h->ntiles : 0);
+    for (unsigned i = 0; ok && i < h->nhistory; i++) {
+        ok = history[i] < h->ntiles;
+        if (ok)
+            counts[history[i]]++;
+    }
+    for (unsigned i = 0; ok && i < nredo; i++) {
+        ok = redo[i] < h->ntiles;
+        if (ok)
+            undone[redo[i]]++;
+    }
+    for (unsigned i = 0; ok && i < h->ntiles; i++)
+        ok = counts[i] == bts[i].ncurves && undone[i] == bts[i].nundone;
+    // No tile is in the file twice. Looking the tiles up makes the ones that
+    // don't exist yet, but with nothing in them, which changes nothing.
+    vector<tiles::tile *> ts(ok? h->ntiles : 0);
+    set<tiles::tile *> seen;
+    for (unsigned i = 0; ok && i < h->ntiles; i++) {
+        ts[i] = find_tile(base, size, bts[i].path_offset, bts[i].path_length);
+        ok = ts[i] != NULL && ts[i]->ncurves == 0 &&
+            seen.insert(ts[i]).second;
+    }
+    tiles::tile *view_tile = ok? find_tile(base, size, h->view_tile_offset,
+            h->view_tile_length) : NULL;
+    ok = ok && view_tile != NULL;
+    if (!ok)
+        return false;
+
+    // The mapping stays for as long as the tiles use it, which is until they
+    // are changed, or moved onto a later save of the board.
+    for (unsigned i = 0; i < h->ntiles; i++) {
+        const board_tile &bt = bts[i];
+        tiles::map_curves(ts[i],
+                (const complex<float> *)(base + bt.points_offset),
+                (const unsigned *)(base + bt.starts_offset),
+                bt.ncurves, bt.nundone, bt.radius, m);
+    }
+    b->history.resize(h->nhistory);
+    for (unsigned i = 0; i < h->nhistory; i++)
+        b->history[i] = ts[history[i]];
+    b->redo.resize(nredo);
+    for (unsigned i = 0; i < nredo; i++)
+        b->redo[i] = ts[redo[i]];
+    b->view_tile = view_tile;
+    b->view = get_mobius(h->view);
+    b->background_view = get_mobius(h->background_view);
+    b->generation = h->generation;
+    return true;
+}
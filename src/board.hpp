@@ -0,0 +1,59 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <stdint.h>
+
+#include <complex>
+#include <vector>
+
+#include "poincare.hpp"
+#include "tiles.hpp"
+
+// Saving boards to files, and loading them back. See board.cpp.
+
+// What there is to a board besides the tiles: the tile of every curve, in the
+// order they were drawn, and of every curve that can be redone, in the order
+// they were undone, the views of the board and of the background, as in
+// infiniboard.cpp, and the generation of the journal that continues the board.
+// See journal.hpp.
+struct board_state {
+    vector<tiles::tile *> history, redo;
+    tiles::tile *view_tile;
+    poincare::mobius view, background_view;
+    unsigned generation;
+};
+
+// A copy of what save_board() needs of a board, which it can save from on
+// another thread while the board carries on changing. A tile's curves are in
+// points and starts, in the mapping of a board file, if mapped, which mapping
+// keeps mapped until the snapshot is done with, and otherwise in own_points
+// and own_starts. See snapshot_board().
+struct snapshot_tile {
+    tiles::tile *t;
+    vector<uint8_t> path;
+    unsigned ncurves, nundone, version;
+    float radius;
+    bool mapped;
+    const complex<float> *points;
+    const unsigned *starts;
+    shared_ptr<const void> mapping;
+    vector<complex<float>> own_points;
+    vector<unsigned> own_starts;
+};
+struct board_snapshot {
+    vector<snapshot_tile> tiles;
+    vector<uint32_t> history, redo;  // indices into tiles
+    vector<uint8_t> view_tile;
+    poincare::mobius view, background_view;
+    unsigned generation;
+};
+
+void erase_curve(vector<tiles::tile *> *history, tiles::tile *t, unsigned i);
+bool clip_curves(vector<tiles::tile *> *history, tiles::tile *t,
+        vector<unsigned> *cs, tiles::disc d);
+board_snapshot snapshot_board(const board_state &b);
+bool save_snapshot(const char *fn, const board_snapshot &s);
+bool save_board(const char *fn, const board_state &b);
+void remap_board(const char *fn, const board_snapshot &s);
+bool load_board(const char *fn, board_state *b);
@@ -5,8 +5,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <atomic>
 #include <complex>
 #include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 using namespace std;
 
 #include <GL/glew.h>  // needed for shaders and shit.
@@ -171,3 +175,106 @@ float norminff(complex<float> a)
 {
     return max(abs(real(a)), abs(imag(a)));
 }
+
+
+// Below this many iterations, it isn't worth waking anybody up.
+#define PARALLEL_MIN 0x1000
+
+// The thread pool behind parallel_for(). One job runs at a time. The workers
+// and the calling thread all take chunks of the job's range until there are
+// none left. The pool is never freed: the workers are still waiting on it when
+// the process exits, and destroying a condition variable with waiters on it
+// blocks forever.
+struct pool {
+    mutex run_lock;  // held by whoever is running a job
+    mutex lock;  // protects everything below
+    condition_variable start, done;
+    unsigned nworkers;
+    const function<void(unsigned, unsigned)> *job;
+    unsigned n, chunk;
+    atomic<unsigned> next;
+    unsigned generation;
+    unsigned busy;
+};
+static pool *g_pool = NULL;
+static once_flag g_pool_once;
+
+static void run_chunks(const function<void(unsigned, unsigned)> &f,
+        unsigned n, unsigned chunk)
+{
+    for (;;) {
+        unsigned i = g_pool->next.fetch_add(chunk);
+        if (i >= n)
+            return;
+        f(i, min(i + chunk, n));
+    }
+}
+
+static void worker(void)
+{
+    pool *P = g_pool;
+    unsigned generation = 0;
+    for (;;) {
+        unique_lock<mutex> l(P->lock);
+        P->start.wait(l, [&]{ return P->generation != generation; });
+        generation = P->generation;
+        const function<void(unsigned, unsigned)> *f = P->job;
+        unsigned n = P->n, chunk = P->chunk;
+        l.unlock();
+
+        run_chunks(*f, n, chunk);
+
+        l.lock();
+        if (--P->busy == 0)
+            P->done.notify_one();
+    }
+}
+
+static void start_pool(void)
+{
+    g_pool = new pool;
+    g_pool->nworkers = 0;
+    g_pool->generation = 0;
+    unsigned nthreads = thread::hardware_concurrency();
+    for (unsigned i = 1; i < nthreads; i++) {
+        thread(worker).detach();
+        g_pool->nworkers++;
+    }
+}
+
+// Call f(begin, end) on disjoint ranges that cover [0, n), on every core, and
+// return when they are all done. Which ranges run where is up for grabs, so f
+// has to do the same thing no matter how [0, n) gets split up.
+void parallel_for(unsigned n, const function<void(unsigned, unsigned)> &f)
+{
+    if (n < PARALLEL_MIN) {
+        f(0, n);
+        return;
+    }
+    call_once(g_pool_once, start_pool);
+    pool *P = g_pool;
+    if (P->nworkers == 0) {
+        f(0, n);
+        return;
+    }
+
+    lock_guard<mutex> run(P->run_lock);
+    // A few chunks per thread, so that a slow thread doesn't hold everybody
+    // up.
+    unsigned chunk = max(n/(4*(P->nworkers + 1)), 1u);
+    {
+        lock_guard<mutex> l(P->lock);
+        P->job = &f;
+        P->n = n;
+        P->chunk = chunk;
+        P->next = 0;
+        P->busy = P->nworkers;
+        P->generation++;
+    }
+    P->start.notify_all();
+
+    run_chunks(f, n, chunk);
+
+    unique_lock<mutex> l(P->lock);
+    P->done.wait(l, [&]{ return P->busy == 0; });
+}
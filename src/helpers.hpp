@@ -4,6 +4,7 @@
 
 #include <complex>
 #include <cstring>
+#include <functional>
 #include <iostream>
 using namespace std;
 
@@ -46,3 +47,5 @@ void line_strip_to_lines(complex<float> *x, unsigned n,
         complex<float> **py, unsigned *pny);
 
 float norminff(complex<float> a);
+
+void parallel_for(unsigned n, const function<void(unsigned, unsigned)> &f);
@@ -1,8 +1,13 @@
 // vi:fo=qacj com=b\://
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <unistd.h>
 
+#include <chrono>
+#include <thread>
 #include <vector>
 
 #include <GL/glew.h>  // needed for shaders and shit.
@@ -10,11 +15,18 @@
 
 #include "helpers.hpp"
 
+#include "background.hpp"
+#include "board.hpp"
+#include "input.hpp"
+#include "journal.hpp"
+#include "latency.hpp"
 #include "poincare.hpp"
+#include "schedule.hpp"
+#include "tessellate.hpp"
+#include "tiles.hpp"
+#include "trace.hpp"
 
 
-#define T_RENDER 10e-3
-
 // Screen dimension constants
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 700
@@ -22,86 +34,527 @@
 
 #define GRID_SHADE 0.2f
 
-// 16 MiB of space for drawing in should be fine until I can work out the
-// details of memory management. Actually, realistically, it should be fine for
-// as long as I don't have board saving and loading working, because that's the
-// only conceivable way 16 MiB could ever get eaten up by drawing.
-#define DRAW_SPACE (16*MiB)
-#define LINE_WIDTH 0.01f
+// The background mesh is made down to polygons BACKGROUND_PIXELS across, as
+// seen from where the view was when it was made, by background.cpp's thread.
+// It is made again once the view has moved BACKGROUND_DRIFT from there, in the
+// hyperbolic metric, by which point some of what it left out might be a pixel
+// across. See lazy_tiling.hpp.
+#define BACKGROUND_PIXELS .5
+#define BACKGROUND_DRIFT M_LN2
+
+// The foreground is kept in a pool of GPU buffers of this size, which grows as
+// it is drawn in, and each tile's foreground is in as many of them as it
+// needs. See new_chunk().
+#ifndef CHUNK_SIZE
+# define CHUNK_SIZE (MiB/4)
+#endif
+#define CHUNK_POINTS (CHUNK_SIZE/sizeof(complex<float>))
+
+// Tiles further than this from the view, in the hyperbolic metric, are not
+// drawn. At a distance of 8, a unit of length is well under a pixel. The rest
+// is slack for the view not being at the centre of its tile.
+#define CULL_DISTANCE 9.
+
+// Each segment of a curve is drawn as a spline of up to SPLINE_STEPS straight
+// steps, of SPLINE_PIXELS or so on the screen, by glsl/stroke.vert, with
+// STROKE_VERTS vertices: the cap, a stitch, and two for each end of each step.
+#define SPLINE_STEPS 8
+#define SPLINE_PIXELS 4.f
+#define STROKE_VERTS (4 + 2 + 2*(SPLINE_STEPS + 1))
+
+// A tile that is small on the screen is drawn at a lower level of detail, with
+// its curves simplified to within LOD_TOLERANCE of where they are, in the
+// hyperbolic metric, at level 1, and LOD_FACTOR times that at each level after,
+// up to level LOD_LEVELS. The level drawn is the coarsest one that is still
+// within LOD_PIXELS of the real thing on the screen, and tiles that are
+// smaller than that altogether aren't drawn at all. Since the disc shrinks
+// things towards its edge so fast, most tiles in view are drawn at a low level
+// of detail. Levels are made as they are needed, on the input thread, but once
+// tiles of LOD_POINTS points in all, a couple of milliseconds' worth, have been
+// simplified in a round of input, the rest wait for the next, which is a frame
+// later at most, and are drawn at full detail until then.
+#define LOD_PIXELS .5f
+#define LOD_TOLERANCE .004
+#define LOD_FACTOR 4
+#define LOD_LEVELS 5
+#define LOD_POINTS 20000
+
+// How close the eraser has to come to a curve to erase it, as a distance in
+// the disc at its centre, like LINE_WIDTH.
+#define ERASE_RADIUS LINE_WIDTH
+// The radius the clipping eraser starts out with, and the least and most it
+// can be changed to, in the hyperbolic metric, so that it covers the same part
+// of the board wherever it is. [ and ] change it by CLIP_RADIUS_STEP. The
+// outline of it that is drawn has CLIP_VERTS vertices.
+#define CLIP_RADIUS .1
+#define CLIP_RADIUS_MIN .02
+#define CLIP_RADIUS_MAX 2.
+#define CLIP_RADIUS_STEP 1.25
+#define CLIP_VERTS 64
+
+// While drawing, the last point of the curve is moved to the mouse, rather
+// than a new point added, for as long as the curve would stay within
+// SIMPLIFY_PIXELS of every position the mouse has been in, so that the curve
+// looks the same but has far fewer points. Since the mouse is where the
+// drawing is being looked at, a pixel there is the unit. Only SIMPLIFY_MAX
+// positions are kept track of, so that a long straight line doesn't get slow.
+#define SIMPLIFY_PIXELS .5f
+#define SIMPLIFY_MAX 64
+
+// Once the journal gets this big, it is compacted into the board, so that it
+// never takes long to replay. See journal.hpp.
+#define JOURNAL_COMPACT (8*MiB)
 
 #define SCREEN_RATIO ((float)SCREEN_WIDTH / (float)SCREEN_HEIGHT)
+// The size of a pixel in the screen's disc. See screen_to_board().
+#define PIXEL_SIZE (2.f/SCREEN_HEIGHT/SCREEN_ZOOM)
 
 enum {  // mouse states
     IDLE,
     PAN,
-    DRAW
+    DRAW,
+    ERASE,
+    CLIP
 };
 
-void process_events_for(double t);
+void take_event(const trace::event &e);
+void replay_events_for(double dt, double frame);
+void handle_event(const trace::event &e);
+bool update_board(void);
+void update_view(void);
+void update_drawing(void);
+void publish(input::update &&u);
+void apply_updates_at(double t);
+void apply(input::update &u);
+bool update(bool wait);
+void follow_view(void);
+unsigned draw_frames(bool replay, double T);
 
 complex<float> screen_to_board(complex<float> s);
 
 void error_callback(int error, const char* description);
-bool init(void);
+bool init(bool headless);
 bool init_gl();
-void key_callback(GLFWwindow *window, int key, int scancode,
-        int action, int mods);
-void cursor_position_callback(GLFWwindow *window, double sx, double sy);
-void mouse_button_callback(GLFWwindow *window, int button,
-        int action, int mods);
+void key_event(int key, int scancode, int action, int mods);
+void cursor_event(double sx, double sy);
+void button_event(int button, int action, int mods, double sx, double sy);
 void mouse_draw_start(complex<float> p0, complex<float> p1);
 void mouse_draw(complex<float> p0, complex<float> p1, complex<float> p2);
 void mouse_draw_finish(void);
+void recentre_view(void);
+void recentre_background(void);
+void start_background(void);
+void update_background(bool wait);
+void refresh_visible(void);
 void refresh_background(void);
-void refresh_foreground(void);
+void refresh_foreground(tiles::tile *t);
+void grow_foreground(tiles::tile *t, unsigned from, unsigned had);
+void forget_redo(void);
+void erase_foreground(tiles::tile *t, unsigned i);
+void erase_along(complex<float> s0, complex<float> s1);
+void append_foreground(tiles::tile *t, unsigned c);
+void compact_foreground(tiles::tile *t);
+tiles::chunk new_chunk(void);
+void upload_lod(tiles::tile *t, unsigned l, vector<complex<float>> *points,
+        unsigned version);
+void refresh_lod(tiles::tile *t, unsigned l);
+bool refresh_lods(void);
+void show(tiles::tile *t);
+void clip_at(complex<float> p);
+void clip_along(complex<float> s);
+void refresh_eraser(void);
 void render(void);
-bool tasting(void);
+void write_board(void);
+void compact_board(void);
+void finish_compacting(bool wait);
+bool read_board(void);
 
 
-// Globals, prefixed with g_.
+// Globals, prefixed with g_. The GL state belongs to the render thread, and
+// the board, and everything else the events change, to the input thread, which
+// hands over what the render thread needs of it as updates, into g_shown. See
+// input.hpp.
 GLFWwindow *g_window = NULL;
 
-unsigned g_background_len;
-GLuint g_background_vbo;
-unsigned g_p = 3, g_q = 7, g_res = 5, g_niter = 6;
-
-GLuint g_foreground_vbo;
-unsigned g_foreground_len = 0;
-unsigned g_foreground_max = DRAW_SPACE/sizeof(complex<float>);
+// The outline of the clipping eraser, about the origin.
+GLuint g_eraser_vbo;
+// The background is the {g_p, g_q} tiling, with g_res points to each edge.
+unsigned g_p = 3, g_q = 7, g_res = 5;
+// Like g_view, but for the background. The background is periodic, so it is
+// drawn with any g_background_view that differs from the true view by a
+// symmetry of the {g_p, g_q} tiling. recentre_background() picks the one that
+// keeps the view centre in the middle polygon, so that the background's
+// coordinates stay precise. g_turn is what it has moved g_background_view by
+// since the last VIEW update.
+poincare::mobius g_background_view = {1., 0.};
+poincare::mobius g_turn = {1., 0.};
+// A background mesh: the first len points of vbo, and rel, which carries the
+// mesh's coordinates to the background's. Where the view centre was, in the
+// mesh's coordinates, when the mesh was made, is centre.
+struct background_mesh {
+    GLuint vbo;
+    unsigned len;
+    poincare::mobius rel;
+    complex<double> centre;
+};
+// The mesh that is drawn, and the one that the next is uploaded into, then
+// swapped with it. If g_making, a new mesh has been asked of background.cpp
+// and not collected yet, and in the meantime, the old one keeps being drawn,
+// even if it is of some other tiling. g_meshes[1].rel then carries the
+// background's coordinates as they were when it was asked for to what they are
+// now.
+background_mesh g_meshes[2];
+bool g_making = false;
+// Whether the background is drawn a pixel at a time, by glsl/tiling.frag,
+// rather than from the mesh, which then isn't made at all. That goes on
+// forever, and changing the tiling costs nothing. B switches between them.
+bool g_procedural = false;
+// What glsl/tiling.frag needs to know about the {g_p, g_q} tiling.
+float g_tiling_phi, g_edge_radius, g_polygon_size;
+complex<float> g_edge_centre;
+
+// Chunks that no tile is using any more.
+vector<GLuint> g_free_chunks;
 
 GLuint g_poincare_program;
-GLuint g_pan_uni;
+GLuint g_view_a_uni, g_view_b_uni;
 GLuint g_colour_uni;
 GLuint g_position_attrib;
+// The foreground is drawn with a program of its own. See tessellate.hpp.
+GLuint g_stroke_program;
+GLuint g_stroke_view_a_uni, g_stroke_view_b_uni;
+GLuint g_corner_attrib, g_control_attribs[4];
+// The vertices every segment is drawn with. See glsl/stroke.vert.
+GLuint g_stroke_vbo;
+// So is the procedural background, over g_disc_vbo, the square around the
+// disc.
+GLuint g_tiling_program;
+GLuint g_tiling_view_a_uni, g_tiling_view_b_uni;
+GLuint g_phi_uni, g_edge_centre_uni, g_edge_radius_uni, g_polygon_size_uni;
+GLuint g_disc_attrib;
+GLuint g_disc_vbo;
+
+// What the render thread draws, as of the last update it has had from the
+// input thread: the views, the tiles close enough to draw, the tiling, and the
+// clipping eraser, each as the input thread's own are. See apply().
+struct {
+    poincare::mobius view, background_view;
+    vector<pair<tiles::tile *, poincare::mobius>> visible;
+    unsigned p, q, res;
+    bool procedural;
+    double clip_radius;
+    bool clipping;
+    complex<float> clip_cursor;
+} g_shown;
 
 
 int g_mouse_state = IDLE;
-// This is more or less the board's foreground state. This is a list of curves,
-// each curve being approximated by a series of points. There is a one-to-one
-// correspondence (currently) between mouse positions while drawing and points
-// in the curve.
-vector<vector<complex<float>>> g_curves;
-
-complex<float> g_pan = 0.f;
-// The point in board space (in the reference configuration) where the mouse is
-// during the start of a pan operation.
+// The board's foreground state is a bunch of curves, each curve being
+// approximated by a series of points, kept in the tiles. See tiles.hpp. The
+// points are the mouse positions while drawing, less the ones the curve
+// doesn't need to pass through to look the same (see SIMPLIFY_PIXELS). This
+// is the tile of every curve, in the order they were drawn.
+vector<tiles::tile *> g_history;
+// The tile of every curve that has been undone and not redone, in the order
+// they were undone.
+vector<tiles::tile *> g_redo;
+
+// The view is the tile g_view_tile, plus g_view, which carries the view tile's
+// local coordinates to the screen. recentre_view() keeps g_view small.
+tiles::tile *g_view_tile;
+poincare::mobius g_view = {1., 0.};
+// The tiles that are close enough to the view to be drawn, along with
+// relative(g_view_tile, tile) for each.
+vector<pair<tiles::tile *, poincare::mobius>> g_visible;
+
+// The point on the screen's disc where the mouse is during the start of a pan
+// operation, and what g_view and g_background_view were at the time.
 complex<float> g_pan_start = 0.f;
+poincare::mobius g_pan_view, g_pan_background;
+
+// Where the eraser was at the last mouse event, on the screen.
+complex<float> g_erase_last;
+// The clipping eraser's radius, where on the board it last clipped, and where
+// it is now.
+double g_clip_radius = CLIP_RADIUS;
+complex<float> g_clip_last, g_clip_cursor;
+
+// The tile the current curve is being drawn in, and relative(g_draw_tile,
+// g_view_tile).
+tiles::tile *g_draw_tile;
+poincare::mobius g_draw_rel;
+// Where the mouse has been, in g_draw_tile-local coordinates, since the second
+// last point of the current curve, not counting the last point. See
+// SIMPLIFY_PIXELS.
+vector<complex<float>> g_draw_skipped;
+// How many points of the current curve are in its tile's foreground, and the
+// first of them that has moved since it was put there, or g_draw_uploaded if
+// none has. See update_drawing().
+unsigned g_draw_uploaded, g_draw_moved;
+
+// What has changed since the last round of input, on the input thread, and
+// since the last frame, on the render thread. The event handlers only mark
+// what they change, where the work of bringing everything else up to date can
+// wait, and update_board() does it, once a round, however many events there
+// were, and hands over what the render thread needs to know. update() then
+// does the same for the render thread, once a frame. A frame in which nothing
+// has changed isn't drawn at all. See draw_frames(). To begin with, everything
+// the render thread needs has yet to be handed over.
+enum {
+    DIRTY_FRAME = 1,  // something that is drawn has changed
+    DIRTY_VIEW = 2,  // the view has moved, and may need recentring
+    DIRTY_DRAWING = 4,  // the current curve has grown or moved
+    DIRTY_BACKGROUND = 8,  // the tiling has changed
+    DIRTY_ERASER = 16,  // the clipping eraser has changed size, or moved
+    DIRTY_VISIBLE = 32,  // different tiles are close enough to draw
+};
+unsigned g_changed = DIRTY_VIEW | DIRTY_BACKGROUND | DIRTY_ERASER |
+    DIRTY_VISIBLE;
+unsigned g_dirty = DIRTY_FRAME;
 
-unsigned char g_frame_counter = 0;
+// Whether updates are applied as soon as they are published, rather than
+// handed over to the render thread: until the render thread starts, and during
+// a replay, which has no input thread. See publish().
+bool g_direct = true;
 
+// During a replay, the time according to the trace. See replay_events_for().
+double g_replay_t = 0;
 
-// Process events for dt seconds, then return. Should almost always return in
-// exactly dt seconds.
-void process_events_for(double dt)
+// The board file given with --board, or NULL. See board.cpp.
+const char *g_board_file = NULL;
+
+
+// Handle an event from the input thread's callbacks. What it does is published
+// at the end of the round. See main().
+void take_event(const trace::event &e)
 {
-    for (;;) {
-        double t0 = glfwGetTime();
-        glfwWaitEventsTimeout(dt);
-        double u = glfwGetTime() - t0;
-        if (u >= dt)
-            return;
-        dt -= u;
+    publish({input::MARK, e.t});
+    handle_event(e);
+}
+// The replay's version of the input thread: handle every event in the trace
+// from the next dt seconds, then move the trace's clock on by a whole frame.
+// No time actually passes, so a replay goes as fast as the rendering does, and
+// events always land in the same frames. The replay ends at the first frame
+// after the end of the trace that there is nothing left to draw in, so that
+// whatever the last events started, such as making the background, is
+// finished.
+void replay_events_for(double dt, double frame)
+{
+    trace::event e;
+    while (trace::next(g_replay_t + dt, &e)) {
+        latency::mark(latency::INPUT);
+        handle_event(e);
+    }
+    g_replay_t += frame;
+}
+void handle_event(const trace::event &e)
+{
+    switch (e.k) {
+    case trace::KEY:
+        key_event(e.key, e.scancode, e.action, e.mods);
+        break;
+    case trace::CURSOR:
+        cursor_event(e.x, e.y);
+        break;
+    case trace::BUTTON:
+        button_event(e.button, e.action, e.mods, e.x, e.y);
+        break;
+    case trace::REFRESH:
+        publish({input::REFRESH});
+        break;
+    }
+}
+
+// Do whatever the events of this round have left to be done, journal what
+// they did to the board, and hand the render thread everything it needs to
+// know of it. Return whether there is anything left to do, for lack of time,
+// which there will be more of in a frame, whether more events come or not.
+bool update_board(void)
+{
+    if (g_changed & DIRTY_BACKGROUND) {
+        input::update u = {input::TILING};
+        u.p = g_p;
+        u.q = g_q;
+        u.res = g_res;
+        u.procedural = g_procedural;
+        publish(std::move(u));
+        // The tiling may have changed shape.
+        g_changed |= DIRTY_VIEW;
+    }
+    update_view();
+    update_drawing();
+    if (g_changed & DIRTY_VISIBLE) {
+        input::update u = {input::VISIBLE};
+        u.visible = g_visible;
+        publish(std::move(u));
+    }
+    if (g_changed & DIRTY_VIEW) {
+        input::update u = {input::VIEW};
+        u.view = g_view;
+        u.background_view = g_background_view;
+        u.turn = g_turn;
+        publish(std::move(u));
+        g_turn = poincare::identity();
+    }
+    if (g_changed & DIRTY_ERASER) {
+        input::update u = {input::ERASER};
+        u.radius = g_clip_radius;
+        u.shown = g_mouse_state == CLIP;
+        u.centre = g_clip_cursor;
+        publish(std::move(u));
+    }
+    bool more = refresh_lods();
+    g_changed = 0;
+
+    // Journal whatever the events did to the board.
+    journal::flush();
+    finish_compacting(false);
+    if (!journal::compacting() && journal::size() > JOURNAL_COMPACT &&
+            g_mouse_state != DRAW)
+        compact_board();
+    if (!g_direct)
+        input::publish();
+    return more;
+}
+// Recentre the view, if it has moved.
+void update_view(void)
+{
+    if (!(g_changed & DIRTY_VIEW))
+        return;
+    recentre_view();
+    recentre_background();
+}
+// Tessellate whatever has changed of the current curve, if anything has.
+void update_drawing(void)
+{
+    if (!(g_changed & DIRTY_DRAWING))
+        return;
+    tiles::tile *t = g_draw_tile;
+    unsigned c = t->ncurves - 1;
+    grow_foreground(t, g_draw_moved, g_draw_uploaded);
+    g_draw_uploaded = g_draw_moved = t->starts[c + 1] - t->starts[c];
+    g_changed &= ~DIRTY_DRAWING;
+}
+// Hand u over to the render thread, at the end of the round, or apply it now,
+// if there is no render thread to hand it to. See g_direct.
+void publish(input::update &&u)
+{
+    if (g_direct)
+        apply(u);
+    else
+        input::push(std::move(u));
+}
+
+// Wait until t, by glfwGetTime(), then apply every round of updates that the
+// input thread has handed over since the last time. See input.hpp.
+void apply_updates_at(double t)
+{
+    double dt = t - glfwGetTime();
+    if (dt > 0)
+        this_thread::sleep_for(chrono::duration<double>(dt));
+    vector<input::update> round;
+    while (input::next(&round)) {
+        for (input::update &u : round)
+            apply(u);
+    }
+}
+// Bring the render thread up to date with u. Everything but a MARK or a
+// REPORT changes what is drawn.
+void apply(input::update &u)
+{
+    tiles::tile *t = u.tile;
+    switch (u.k) {
+    case input::MARK:
+        latency::mark(latency::INPUT, u.t);
+        return;
+    case input::REPORT:
+        latency::report(stdout);
+        return;
+    case input::REFRESH:
+        break;
+    case input::VIEW:
+        g_shown.view = u.view;
+        g_shown.background_view = u.background_view;
+        // The meshes stay where they were on the screen.
+        for (background_mesh &m : g_meshes)
+            m.rel = compose(inverse(u.turn), m.rel);
+        g_dirty |= DIRTY_VIEW;
+        break;
+    case input::VISIBLE:
+        swap(g_shown.visible, u.visible);
+        break;
+    case input::UPLOAD:
+        while (t->chunks.size() <= u.n)
+            t->chunks.push_back(new_chunk());
+        t->chunks[u.n].len = u.len;
+        glBindBuffer(GL_ARRAY_BUFFER, t->chunks[u.n].vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, u.first*sizeof(complex<float>),
+                u.points.size()*sizeof(complex<float>), u.points.data());
+        break;
+    case input::TRIM:
+        for (unsigned i = u.n; i < t->chunks.size(); i++)
+            g_free_chunks.push_back(t->chunks[i].vbo);
+        t->chunks.resize(min(u.n, (unsigned)t->chunks.size()));
+        if (!t->chunks.empty())
+            t->chunks.back().len = u.len;
+        break;
+    case input::SHOW:
+        t->extent = u.extent;
+        t->shown_version = u.version;
+        t->shown_radius = u.radius;
+        break;
+    case input::LOD:
+        upload_lod(t, u.n, &u.points, u.version);
+        break;
+    case input::TILING:
+        g_shown.p = u.p;
+        g_shown.q = u.q;
+        g_shown.res = u.res;
+        g_shown.procedural = u.procedural;
+        g_dirty |= DIRTY_BACKGROUND;
+        break;
+    case input::ERASER:
+        if (u.radius != g_shown.clip_radius)
+            g_dirty |= DIRTY_ERASER;
+        g_shown.clip_radius = u.radius;
+        g_shown.clipping = u.shown;
+        g_shown.clip_cursor = u.centre;
+        break;
     }
+    g_dirty |= DIRTY_FRAME;
+}
+
+// Do whatever the updates since the last frame have left to be done, and
+// return whether anything has changed since then. If wait, wait for the
+// background mesh, if one has been asked for, rather than drawing the old one,
+// so that a replay always draws the same frames.
+bool update(bool wait)
+{
+    if (g_dirty & DIRTY_BACKGROUND)
+        refresh_background();
+    if (g_dirty & DIRTY_ERASER)
+        refresh_eraser();
+    follow_view();
+    update_background(wait);
+    bool changed = g_dirty != 0;
+    g_dirty = 0;
+    return changed;
+}
+// If the view has gone far enough from where the background mesh was made
+// around, make it again around here.
+void follow_view(void)
+{
+    if (!(g_dirty & DIRTY_VIEW))
+        return;
+    g_dirty &= ~DIRTY_VIEW;
+    if (g_shown.procedural || g_making || g_meshes[0].len == 0)
+        return;
+    const background_mesh &m = g_meshes[0];
+    complex<double> c = image(inverse(compose(g_shown.background_view,
+                    m.rel)), complex<double>(0));
+    if (2*atanh(abs((c - m.centre)/(1. - conj(m.centre)*c))) >
+            BACKGROUND_DRIFT)
+        start_background();
 }
 
 
@@ -118,11 +571,16 @@ void error_callback(int error, const char *description)
     fprintf(stderr, "Error: %s\n", description);
 }
 // Start up glfw, create window, and initialise the glfw- and vendor-specific
-// OpenGL state.
-bool init(void)
+// OpenGL state. If headless, there is no display; draw offscreen instead.
+bool init(bool headless)
 {
     glfwSetErrorCallback(error_callback);
 
+#ifdef GLFW_PLATFORM_NULL
+    // glfw 3.4 and up can do without a display server altogether.
+    if (headless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     if (!glfwInit())
         return false;
 
@@ -132,14 +590,23 @@ bool init(void)
     // Set OpenGL version.
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_SAMPLES, 8);
+    if (headless) {
+        // A surfaceless EGL context, which works on any Mesa driver,
+        // including the software ones. Failing that, OSMesa.
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    } else {
+        glfwWindowHint(GLFW_SAMPLES, 8);
+    }
     g_window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "infiniboard",
             NULL, NULL);
+    if (g_window == NULL && headless) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        g_window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT,
+                "infiniboard", NULL, NULL);
+    }
     if (g_window == NULL)
         return false;
-    glfwSetKeyCallback(g_window, key_callback);
-    glfwSetCursorPosCallback(g_window, cursor_position_callback);
-    glfwSetMouseButtonCallback(g_window, mouse_button_callback);
     glfwMakeContextCurrent(g_window);
 
 
@@ -154,6 +621,22 @@ bool init(void)
     // wait before swapping buffers.
     glfwSwapInterval(1);
 
+    if (headless) {
+        // There may be no default framebuffer to draw to, so draw to one of
+        // our own.
+        GLuint fbo, rbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glGenRenderbuffers(1, &rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8,
+                SCREEN_WIDTH, SCREEN_HEIGHT);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_RENDERBUFFER, rbo);
+        glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        gl_assert();
+    }
+
     // Initialise OpenGL.
     if (!init_gl()) {
         printf("Unable to initialise OpenGL!\n");
@@ -166,15 +649,15 @@ bool init(void)
 // Initialises the generic OpenGL state.
 bool init_gl()
 {
-    //---- Make the background VBO. ----
-    glGenBuffers(1, &g_background_vbo);
-    refresh_background();
+    //---- Make the background VBOs. ----
+    for (background_mesh &m : g_meshes)
+        glGenBuffers(1, &m.vbo);
+    glGenBuffers(1, &g_eraser_vbo);
 
-    // Make the foreground VBO.
-    glGenBuffers(1, &g_foreground_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, g_foreground_vbo);
-    glBufferData(GL_ARRAY_BUFFER, g_foreground_max*sizeof(complex<float>),
-            NULL, GL_DYNAMIC_DRAW);
+    // The foreground VBOs get made as tiles get drawn in. Start off looking at
+    // the origin.
+    g_view_tile = tiles::origin();
+    refresh_visible();
 
 
     g_poincare_program = shader_program(
@@ -190,7 +673,8 @@ bool init_gl()
     // Well, enable them, then.
     glEnableVertexAttribArray(g_position_attrib);
 
-    g_pan_uni = glGetUniformLocation(g_poincare_program, "pan");
+    g_view_a_uni = glGetUniformLocation(g_poincare_program, "view_a");
+    g_view_b_uni = glGetUniformLocation(g_poincare_program, "view_b");
     g_colour_uni = glGetUniformLocation(g_poincare_program, "colour");
 
     // For all subsequent draw calls, pass SCREEN_RATIO into the uniform vertex
@@ -201,6 +685,81 @@ bool init_gl()
             SCREEN_ZOOM);
 
 
+    // Segments are drawn as instances, which OpenGL 2.1 needs an extension
+    // for, though almost everything has it.
+    if (!GLEW_ARB_instanced_arrays) {
+        printf("OpenGL has no GL_ARB_instanced_arrays!\n");
+        return false;
+    }
+    g_stroke_program = shader_program("glsl/stroke.vert", "glsl/mono.frag");
+    glUseProgram(g_stroke_program);
+    g_corner_attrib = glGetAttribLocation(g_stroke_program, "corner");
+    for (unsigned j = 0; j < 4; j++) {
+        char name[] = "p0";
+        name[1] += j;
+        g_control_attribs[j] = glGetAttribLocation(g_stroke_program, name);
+    }
+    g_stroke_view_a_uni = glGetUniformLocation(g_stroke_program, "view_a");
+    g_stroke_view_b_uni = glGetUniformLocation(g_stroke_program, "view_b");
+    glUniform1f(glGetUniformLocation(g_stroke_program, "screen_ratio"),
+            SCREEN_RATIO);
+    glUniform1f(glGetUniformLocation(g_stroke_program, "screen_zoom"),
+            SCREEN_ZOOM);
+    glUniform1f(glGetUniformLocation(g_stroke_program, "line_width"),
+            LINE_WIDTH);
+    glUniform1f(glGetUniformLocation(g_stroke_program, "spline_steps"),
+            SPLINE_STEPS);
+    glUniform1f(glGetUniformLocation(g_stroke_program, "step_size"),
+            SPLINE_PIXELS*PIXEL_SIZE);
+    glUniform4f(glGetUniformLocation(g_stroke_program, "colour"),
+            1.f, 1.f, 1.f, 1.f);
+
+    // The cap, its last corner again, the first vertex of the first step
+    // again, and then the steps.
+    vector<complex<float>> corners;
+    for (unsigned k = 0; k < 4; k++)
+        corners.push_back({-1.f, (float)k});
+    corners.push_back({-1.f, 3.f});
+    corners.push_back({0.f, 1.f});
+    for (unsigned i = 0; i <= SPLINE_STEPS; i++) {
+        corners.push_back({(float)i, 1.f});
+        corners.push_back({(float)i, -1.f});
+    }
+    assert(corners.size() == STROKE_VERTS);
+    glGenBuffers(1, &g_stroke_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_stroke_vbo);
+    glBufferData(GL_ARRAY_BUFFER, corners.size()*sizeof(complex<float>),
+            corners.data(), GL_STATIC_DRAW);
+    gl_assert();
+
+    g_tiling_program = shader_program("glsl/disc.vert", "glsl/tiling.frag");
+    glUseProgram(g_tiling_program);
+    g_disc_attrib = glGetAttribLocation(g_tiling_program, "position");
+    g_tiling_view_a_uni = glGetUniformLocation(g_tiling_program, "view_a");
+    g_tiling_view_b_uni = glGetUniformLocation(g_tiling_program, "view_b");
+    g_phi_uni = glGetUniformLocation(g_tiling_program, "phi");
+    g_edge_centre_uni = glGetUniformLocation(g_tiling_program, "edge_centre");
+    g_edge_radius_uni = glGetUniformLocation(g_tiling_program, "edge_radius");
+    g_polygon_size_uni =
+        glGetUniformLocation(g_tiling_program, "polygon_size");
+    glUniform1f(glGetUniformLocation(g_tiling_program, "screen_ratio"),
+            SCREEN_RATIO);
+    glUniform1f(glGetUniformLocation(g_tiling_program, "screen_zoom"),
+            SCREEN_ZOOM);
+    glUniform1f(glGetUniformLocation(g_tiling_program, "pixel_size"),
+            PIXEL_SIZE);
+    glUniform4f(glGetUniformLocation(g_tiling_program, "colour"),
+            GRID_SHADE, GRID_SHADE, GRID_SHADE, 1.f);
+    complex<float> square[] = {{-1.f, -1.f}, {1.f, -1.f}, {-1.f, 1.f},
+        {1.f, 1.f}};
+    glGenBuffers(1, &g_disc_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_disc_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(square), square, GL_STATIC_DRAW);
+    gl_assert();
+
+    glUseProgram(g_poincare_program);
+
+
     // Set the colour to be used in all subsequent glClear(GL_COLOR_BUFFER_BIT)
     // commands.
     glClearColor(0, 0, 0, 1);
@@ -209,250 +768,921 @@ bool init_gl()
     return true;
 }
 
-// Per-frame actions.
-void render(void)
+// Pass the mobius f to the view_a and view_b uniforms of the vertex shader.
+static void set_view(const poincare::mobius &f)
+{
+    glUniform2f(g_view_a_uni, real(f.a), imag(f.a));
+    glUniform2f(g_view_b_uni, real(f.b), imag(f.b));
+}
+// The same, for the stroke program.
+static void set_stroke_view(const poincare::mobius &f)
+{
+    glUniform2f(g_stroke_view_a_uni, real(f.a), imag(f.a));
+    glUniform2f(g_stroke_view_b_uni, real(f.b), imag(f.b));
+}
+// Draw the first len points of the strip in vbo, with the stroke program.
+static void draw_strip(GLuint vbo, unsigned len)
 {
-    glUniform2f(g_pan_uni, real(g_pan), imag(g_pan));
+    if (len <= 2)
+        return;
+    // Instance i gets points i to i + 3. See tessellate.hpp.
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (unsigned j = 0; j < 4; j++) {
+        glVertexAttribPointer(g_control_attribs[j], 2, GL_FLOAT, GL_FALSE, 0,
+                (const void *)(j*sizeof(complex<float>)));
+    }
+    glDrawArraysInstancedARB(GL_TRIANGLE_STRIP, 0, STROKE_VERTS, len - 2);
+}
 
+// Draw the background with the tiling program. See glsl/tiling.frag.
+static void draw_tiling(void)
+{
+    glUseProgram(g_tiling_program);
+    poincare::mobius f = inverse(g_shown.background_view);
+    glUniform2f(g_tiling_view_a_uni, real(f.a), imag(f.a));
+    glUniform2f(g_tiling_view_b_uni, real(f.b), imag(f.b));
+    glUniform1f(g_phi_uni, g_tiling_phi);
+    glUniform2f(g_edge_centre_uni, real(g_edge_centre), imag(g_edge_centre));
+    glUniform1f(g_edge_radius_uni, g_edge_radius);
+    glUniform1f(g_polygon_size_uni, g_polygon_size);
+
+    glDisableVertexAttribArray(g_position_attrib);
+    glBindBuffer(GL_ARRAY_BUFFER, g_disc_vbo);
+    glVertexAttribPointer(g_disc_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(g_disc_attrib);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(g_disc_attrib);
 
-    glBindBuffer(GL_ARRAY_BUFFER, g_background_vbo);
-    // Pass the currently bound VBO (g_background_vbo) to the "position" input
-    // of the vertex shader.  This will associate one 2-vector out of
-    // background_data with every vertex the vertex shader processes. That
-    // 2-vector gets accessed by the name "position". It could be any name or
-    // any data type.  It is up to the vertex shader to figure out how to turn
-    // that data into a vertex position.
-    glVertexAttribPointer(g_position_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glUseProgram(g_poincare_program);
+    glEnableVertexAttribArray(g_position_attrib);
+}
 
-    // Draw lines with the active shader program and its current inputs.
-    glUniform4f(g_colour_uni, GRID_SHADE, GRID_SHADE, GRID_SHADE, 1.f);
-    glDrawArrays(GL_LINES, 0, g_background_len);
+// The level of detail to draw a tile of the given radius at, when f carries
+// its local coordinates to the screen, or -1 if it is too small to see. See
+// LOD_PIXELS.
+static int lod_level(float radius, const poincare::mobius &f)
+{
+    // A hyperbolic length at a distance d from the middle of the screen is
+    // scale times that in the screen's disc. The tile's curves are shrunk the
+    // least where they come closest to the middle.
+    double d = max(2*atanh(abs(f.b/conj(f.a))) - radius, 0.);
+    double scale = 1/(2*cosh(d/2)*cosh(d/2));
+    double pixels = LOD_PIXELS*PIXEL_SIZE;
+    if (2*(radius + LINE_WIDTH)*scale < pixels)
+        return -1;
+    int l = 0;
+    for (double e = LOD_TOLERANCE; l < LOD_LEVELS && e*scale <= pixels;
+            e *= LOD_FACTOR)
+        l++;
+    return l;
+}
 
+// Per-frame actions.
+void render(void)
+{
+    if (g_shown.procedural) {
+        draw_tiling();
+    } else {
+        const background_mesh &m = g_meshes[0];
+        set_view(compose(g_shown.background_view, m.rel));
+
+
+        glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+        // Pass the currently bound VBO (the mesh's) to the "position"
+        // input of the vertex shader.  This will associate one 2-vector out of
+        // background_data with every vertex the vertex shader processes. That
+        // 2-vector gets accessed by the name "position". It could be any name
+        // or any data type.  It is up to the vertex shader to figure out how
+        // to turn that data into a vertex position.
+        glVertexAttribPointer(g_position_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+        // Draw lines with the active shader program and its current inputs.
+        glUniform4f(g_colour_uni, GRID_SHADE, GRID_SHADE, GRID_SHADE, 1.f);
+        glDrawArrays(GL_LINES, 0, m.len);
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, g_foreground_vbo);
-    glVertexAttribPointer(g_position_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
-    glUniform4f(g_colour_uni, 1.f, 1.f, 1.f, 1.f);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, g_foreground_len);
+    // Switch to the stroke program, whose attributes are every vertex of
+    // g_stroke_vbo for every instance, and then the next control point of
+    // the strip for every instance. See draw_strip().
+    glUseProgram(g_stroke_program);
+    glDisableVertexAttribArray(g_position_attrib);
+    glBindBuffer(GL_ARRAY_BUFFER, g_stroke_vbo);
+    glVertexAttribPointer(g_corner_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(g_corner_attrib);
+    for (GLuint a : g_control_attribs) {
+        glEnableVertexAttribArray(a);
+        glVertexAttribDivisorARB(a, 1);
+    }
+    for (auto& v : g_shown.visible) {
+        tiles::tile *t = v.first;
+        pair<unsigned, unsigned> e = t->extent;
+        if (e.first == 0)
+            continue;
+        poincare::mobius f = compose(g_shown.view, v.second);
+        int l = lod_level(t->shown_radius, f);
+        if (l == -1)
+            continue;
+        set_stroke_view(f);
+        // Until the level of detail is made from the tile as it is now, it
+        // is drawn at full detail. See refresh_lods().
+        t->lods.resize(LOD_LEVELS);
+        if (l > 0 && t->lods[l - 1].version == t->shown_version) {
+            draw_strip(t->lods[l - 1].vbo, t->lods[l - 1].len);
+            continue;
+        }
+        // Draw up to the end of the last curve that hasn't been undone.
+        for (unsigned i = 0; i < e.first; i++) {
+            draw_strip(t->chunks[i].vbo,
+                    i + 1 < e.first? t->chunks[i].len : e.second);
+        }
+    }
+    for (GLuint a : g_control_attribs) {
+        glVertexAttribDivisorARB(a, 0);
+        glDisableVertexAttribArray(a);
+    }
+    glDisableVertexAttribArray(g_corner_attrib);
+    glUseProgram(g_poincare_program);
+    glEnableVertexAttribArray(g_position_attrib);
+
+    if (g_shown.clipping) {
+        set_view(poincare::translation(g_shown.clip_cursor));
+        glBindBuffer(GL_ARRAY_BUFFER, g_eraser_vbo);
+        glVertexAttribPointer(g_position_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glUniform4f(g_colour_uni, .5f, .5f, .5f, 1.f);
+        glDrawArrays(GL_LINE_LOOP, 0, CLIP_VERTS);
+    }
 }
 
 
-void key_callback(GLFWwindow *window, int key, int scancode,
-        int action, int mods)
+// Only the keys that change what is drawn mark anything dirty, so that the
+// rest, and releases and repeats, don't cost a frame.
+void key_event(int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_Q && action == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
-
-    if (key == GLFW_KEY_U && action == GLFW_PRESS && g_curves.size() > 0) {
-        g_curves.pop_back();
-        refresh_foreground();
+        glfwSetWindowShouldClose(g_window, GLFW_TRUE);
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        publish({input::REPORT});
+    if (key == GLFW_KEY_W && action == GLFW_PRESS && g_board_file != NULL &&
+            g_mouse_state != DRAW)
+        write_board();
+
+    if (key == GLFW_KEY_U && action == GLFW_PRESS && g_history.size() > 0 &&
+            g_mouse_state != DRAW) {
+        tiles::tile *t = g_history.back();
+        g_history.pop_back();
+        tiles::pop_curve(t);
+        g_redo.push_back(t);
+        journal::undo();
+        show(t);
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS && g_redo.size() > 0 &&
+            g_mouse_state != DRAW) {
+        tiles::tile *t = g_redo.back();
+        g_redo.pop_back();
+        tiles::redo_curve(t);
+        g_history.push_back(t);
+        journal::redo();
+        show(t);
+    }
+    if (key == GLFW_KEY_LEFT_BRACKET && action != GLFW_RELEASE &&
+            g_clip_radius/CLIP_RADIUS_STEP >= CLIP_RADIUS_MIN) {
+        g_clip_radius /= CLIP_RADIUS_STEP;
+        g_changed |= DIRTY_ERASER;
+    }
+    if (key == GLFW_KEY_RIGHT_BRACKET && action != GLFW_RELEASE &&
+            g_clip_radius*CLIP_RADIUS_STEP <= CLIP_RADIUS_MAX) {
+        g_clip_radius *= CLIP_RADIUS_STEP;
+        g_changed |= DIRTY_ERASER;
     }
 
     if (key == GLFW_KEY_A && action == GLFW_PRESS) {
         g_p++;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
     if (key == GLFW_KEY_S && action == GLFW_PRESS) {
         g_q++;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
     if (key == GLFW_KEY_D && action == GLFW_PRESS) {
         g_res++;
-        refresh_background();
-    }
-    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
-        g_niter++;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
 
     if (key == GLFW_KEY_Z && action == GLFW_PRESS &&
             2*((g_p - 1) + g_q) < (g_p - 1)*g_q) {
         g_p--;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
     if (key == GLFW_KEY_X && action == GLFW_PRESS &&
             2*(g_p + (g_q - 1)) < g_p*(g_q - 1)) {
         g_q--;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
     if (key == GLFW_KEY_C && action == GLFW_PRESS && g_res > 2) {
         g_res--;
-        refresh_background();
+        g_changed |= DIRTY_BACKGROUND;
     }
-    if (key == GLFW_KEY_V && action == GLFW_PRESS && g_niter > 1) {
-        g_niter--;
-        refresh_background();
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        g_procedural = !g_procedural;
+        g_changed |= DIRTY_BACKGROUND;
+    }
+}
+// Whether the last point of the curve being drawn can be moved to z, in
+// g_draw_tile-local coordinates, without the curve ending up further than e,
+// in the hyperbolic metric, from where it was, or from anywhere in
+// g_draw_skipped.
+static bool simplifies(complex<float> z, float e)
+{
+    tiles::tile *t = g_draw_tile;
+    unsigned end = t->starts[t->ncurves];
+    if (end - t->starts[t->ncurves - 1] < 2 || !(e > 0) ||
+            g_draw_skipped.size() >= SIMPLIFY_MAX)
+        return false;
+    // The last segment would go from a to z. Distances from it are measured
+    // in t-local coordinates, and scaled to the hyperbolic metric at the
+    // point they are measured from.
+    complex<float> a = t->points[end - 2], u = z - a;
+    float l = norm(u);
+    auto near = [&](complex<float> q) {
+        float s = l == 0? 0 : real((q - a)*conj(u))/l;
+        s = s < 0? 0 : s > 1? 1 : s;
+        return norm(q) < 1 && 2*abs(q - (a + s*u)) <= e*(1 - norm(q));
+    };
+    if (!near(t->points[end - 1]))
+        return false;
+    for (complex<float> q : g_draw_skipped) {
+        if (!near(q))
+            return false;
     }
+    return true;
 }
-void cursor_position_callback(GLFWwindow *window, double sx, double sy)
+void cursor_event(double sx, double sy)
 {
     complex<float> s(sx, sy);
-    complex<float> p;
     switch (g_mouse_state) {
     case PAN:
     {
+        // Drag the whole view along by the translation that carries
+        // g_pan_start to the mouse.
         complex<float> p = g_pan_start, q = screen_to_board(s);
         float mod2p = norm(p), mod2q = norm(q);
-        g_pan = ((1 - mod2p)*q - (1 - mod2q)*p) / (1 - mod2p*mod2q);
+        complex<float> pan =
+            ((1 - mod2p)*q - (1 - mod2q)*p) / (1 - mod2p*mod2q);
+        g_view = compose(poincare::translation(pan), g_pan_view);
+        g_background_view = compose(poincare::translation(pan),
+                g_pan_background);
+        g_changed |= DIRTY_VIEW;
     }
         break;
+    case ERASE:
+        erase_along(g_erase_last, s);
+        g_erase_last = s;
+        break;
+    case CLIP:
+        clip_along(s);
+        g_changed |= DIRTY_ERASER;
+        break;
     case DRAW:
-        p = screen_to_board(s);
-        g_curves.back().push_back(poincare::S(-g_pan, p));
-        refresh_foreground();
+    {
+        poincare::mobius f = compose(g_draw_rel, inverse(g_view));
+        complex<float> p = screen_to_board(s), z = image(f, p);
+        if (simplifies(z, SIMPLIFY_PIXELS*PIXEL_SIZE*2/(1 - norm(p)))) {
+            tiles::tile *t = g_draw_tile;
+            unsigned last = t->starts[t->ncurves] - t->starts[t->ncurves - 1]
+                - 1;
+            g_draw_skipped.push_back(t->points[t->starts[t->ncurves] - 1]);
+            tiles::move_point(t, z);
+            journal::move(z);
+            g_draw_moved = min(g_draw_moved, last);
+        } else {
+            g_draw_skipped.clear();
+            tiles::add_point(g_draw_tile, z);
+            journal::point(z);
+        }
+        g_changed |= DIRTY_DRAWING;
+    }
         break;
     }
 }
-void mouse_button_callback(GLFWwindow *window, int button,
-        int action, int mods)
+void button_event(int button, int action, int mods, double sx, double sy)
 {
-    double sx, sy;
-    glfwGetCursorPos(window, &sx, &sy);
     complex<float> s(sx, sy);
     switch (g_mouse_state) {
     case IDLE:
         if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_MIDDLE) {
-            g_pan_start = poincare::S(-g_pan, screen_to_board(s));
+            g_pan_start = screen_to_board(s);
+            g_pan_view = g_view;
+            g_pan_background = g_background_view;
             g_mouse_state = PAN;
         }
         if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
-            complex<float> p = screen_to_board(s);
-            vector<complex<float>> &&v{};
-            v.push_back(poincare::S(-g_pan, p));
-            g_curves.push_back(v);
-            refresh_foreground();
+            // The curve goes in the tile its first point is in.
+            complex<double> z = image(inverse(g_view),
+                    (complex<double>)screen_to_board(s));
+            g_draw_tile = tiles::locate(g_view_tile, &z);
+            g_draw_rel = tiles::relative(g_draw_tile, g_view_tile);
+
+            bool first = !g_draw_tile->inked;
+            forget_redo();
+            tiles::new_curve(g_draw_tile);
+            tiles::add_point(g_draw_tile, (complex<float>)z);
+            journal::curve(g_draw_tile, (complex<float>)z);
+            g_history.push_back(g_draw_tile);
+            g_draw_skipped.clear();
+            grow_foreground(g_draw_tile, 0, 0);
+            g_draw_uploaded = g_draw_moved = 1;
+            if (first)
+                refresh_visible();
             g_mouse_state = DRAW;
         }
+        if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_RIGHT &&
+                (mods & GLFW_MOD_SHIFT)) {
+            g_clip_last = g_clip_cursor = screen_to_board(s);
+            clip_at(g_clip_last);
+            g_mouse_state = CLIP;
+            g_changed |= DIRTY_ERASER;
+        } else if (action == GLFW_PRESS &&
+                button == GLFW_MOUSE_BUTTON_RIGHT) {
+            erase_along(s, s);
+            g_erase_last = s;
+            g_mouse_state = ERASE;
+        }
         break;
     case PAN:
-        if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_MIDDLE)
+        if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_MIDDLE) {
+            update_view();
+            journal::view(g_view_tile, g_view, g_background_view);
             g_mouse_state = IDLE;
+        }
+        break;
+    case ERASE:
+        if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_RIGHT)
+            g_mouse_state = IDLE;
+        break;
+    case CLIP:
+        if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_RIGHT) {
+            g_mouse_state = IDLE;
+            g_changed |= DIRTY_ERASER;
+        }
         break;
     case DRAW:
         if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_LEFT) {
             // This point s is never different from the last one, acquired from
-            // cursor_position_callback().  Do not bother adding s here.
+            // cursor_event().  Do not bother adding s here.
+            update_drawing();
             g_mouse_state = IDLE;
         }
         break;
     }
 }
 
-void refresh_foreground(void)
+// Get a chunk to put some foreground in, from the pool if there are any left
+// in it, or else a brand new one. Call this on the render thread.
+tiles::chunk new_chunk(void)
+{
+    tiles::chunk k = {0, 0};
+    if (!g_free_chunks.empty()) {
+        k.vbo = g_free_chunks.back();
+        g_free_chunks.pop_back();
+    } else {
+        glGenBuffers(1, &k.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, k.vbo);
+        glBufferData(GL_ARRAY_BUFFER, CHUNK_SIZE, NULL, GL_DYNAMIC_DRAW);
+        gl_assert();
+    }
+    return k;
+}
+// Upload *points, t's foreground at level of detail l as of version, on the
+// render thread.
+void upload_lod(tiles::tile *t, unsigned l, vector<complex<float>> *points,
+        unsigned version)
+{
+    t->lods.resize(LOD_LEVELS);
+    tiles::lod &k = t->lods[l - 1];
+    k.len = points->size();
+    k.version = version;
+    // The point after the end is read too. See tessellate.hpp.
+    points->push_back(SEPARATOR);
+    if (k.vbo == 0)
+        glGenBuffers(1, &k.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, k.vbo);
+    glBufferData(GL_ARRAY_BUFFER, points->size()*sizeof(complex<float>),
+            points->data(), GL_STATIC_DRAW);
+    gl_assert();
+}
+
+// The rest of the foreground is worked out on the input thread, which only
+// keeps track of how many points are in each chunk, and has the render thread
+// upload the points to them. Have the n points in y put in t's chunk k,
+// starting at point first.
+static void upload(tiles::tile *t, unsigned k, unsigned first,
+        const complex<float> *y, unsigned n)
+{
+    input::update u = {input::UPLOAD};
+    u.tile = t;
+    u.n = k;
+    u.first = first;
+    u.len = t->lens[k];
+    u.points.assign(y, y + n);
+    publish(std::move(u));
+}
+// Cut t's foreground down to its first n chunks, the last of which is then
+// len points long, and put the rest back in the pool.
+static void trim(tiles::tile *t, unsigned n, unsigned len)
+{
+    t->lens.resize(n);
+    if (n > 0)
+        t->lens.back() = len;
+    input::update u = {input::TRIM};
+    u.tile = t;
+    u.n = n;
+    u.len = len;
+    publish(std::move(u));
+}
+// Hand over how much of t's foreground is to be drawn, now that it, or t, has
+// changed.
+void show(tiles::tile *t)
 {
-    // TODO: A huge amount of the foreground is the same as it was before, in a
-    // predictable way. So almost this entire function doesn't actually have to
-    // get run. It gets very buggy, though, only trying to refresh the parts
-    // that have changed. I'll only do it if it becomes a performance problem.
-    complex<float> shape[] = {
-         3.f + 4if,
-         4.f + 3if,
-        -3.f - 4if,
-        -4.f - 3if,
-        };
-    for (unsigned i = 0; i < 4; i++)
-        shape[i] *= LINE_WIDTH/10;
+    input::update u = {input::SHOW};
+    u.tile = t;
+    u.version = t->version;
+    u.radius = t->radius;
+    if (!t->lens.empty() && t->ncurves > 0) {
+        pair<unsigned, unsigned> e = t->ends[t->ncurves - 1];
+        u.extent = {e.first + 1, e.second};
+    }
+    publish(std::move(u));
+}
+
+// Rebuild t's foreground from its curves, including the undone ones, which
+// might be redone. This is only needed when a tile loaded from a board file
+// first comes into view. Drawing only ever appends, and is handled
+// incrementally by grow_foreground(), and undo and redo only change how much
+// of the foreground is drawn.
+void refresh_foreground(tiles::tile *t)
+{
+    trim(t, 0, 0);
+    t->dead = 0;
+
     // Yes, rendered gets allocated every time, but there's probably not a
     // point in reusing a previous allocation under any circumstances. I'll
-    // only consider it if it isn't fast enough. The same goes for reserving
-    // space---something I actually could do pretty easily but still won't in
-    // case something else changes.
-    vector<complex<float>> rendered;
-    for (auto& curve : g_curves) {
-        unsigned N = curve.size();
-        // Record the location of this curve's first point and reserve room so
-        // that it can be repeated. See "stitching" below.
-        unsigned first_stitch_i = rendered.size();
-        rendered.push_back(0);  
-        for (unsigned i = 0; i < N - 1; i++) {
-            // The first N-1 points require actual lines from one to the next.
-            complex<float> r0 = curve[i],
-                           r1 = curve[i + 1];
-
-            // Zoom the point shape according to where the point is located.
-            complex<float> shape0[4];
-            for (unsigned j = 0; j < 4; j++)
-                // norm is actually the modulus squared. Nice, C++.
-                shape0[j] = shape[j]*(1 - norm(r0));
-            complex<float> shape1[4];
-            for (unsigned j = 0; j < 4; j++)
-                shape1[j] = shape[j]*(1 - norm(r1));
-
-            rendered.push_back(r0 + shape0[0]);
-            rendered.push_back(r0 + shape0[1]);
-            rendered.push_back(r1 + shape1[1]);
-            rendered.push_back(r0 + shape0[2]);
-            rendered.push_back(r1 + shape1[2]);
-            rendered.push_back(r0 + shape0[3]);
-            rendered.push_back(r1 + shape1[3]);
-            rendered.push_back(r0 + shape0[0]);
+    // only consider it if it isn't fast enough.
+    vector<vector<complex<float>>> rendered;
+    t->ends.resize(t->ncurves + t->nundone);
+    tessellate_chunks(t->points, t->starts, t->ncurves + t->nundone,
+            CHUNK_POINTS - 1, &rendered, t->ends.data());
+    for (const vector<complex<float>> &y : rendered) {
+        t->lens.push_back(y.size());
+        upload(t, t->lens.size() - 1, 0, y.data(), y.size());
+    }
+    show(t);
+}
+// Bring t's foreground up to date after points have been appended to its last
+// curve, which may be a brand new curve, or moved, since it had had of its
+// points in the foreground. Only the points from from on have changed, and only
+// they and the separator after them are uploaded, so the cost does not depend
+// on how much has already been drawn. When the last chunk fills up, the rest
+// goes in a new one, and nothing already drawn is ever moved.
+void grow_foreground(tiles::tile *t, unsigned from, unsigned had)
+{
+    unsigned c = t->ncurves - 1, n = t->starts[c + 1] - t->starts[c];
+    const complex<float> *curve = t->points + t->starts[c];
+    vector<complex<float>> y;
+    unsigned nback = tessellate_tail(curve, n, from, had, &y);
+
+    // The point after the end of the strip is read too. Only the last point
+    // ever moves, and it is always in the last chunk (see below), so the
+    // points to be written over are too.
+    unsigned k = t->lens.size() - 1;  // the last chunk, if there is one
+    if (!t->lens.empty() &&
+            t->lens[k] - nback + y.size() <= CHUNK_POINTS - 1) {
+        unsigned first = t->lens[k] - nback;  // where y goes in the chunk
+        t->lens[k] = first + y.size();
+        upload(t, k, first, y.data(), y.size());
+    } else {
+        // The moved points that were in the last chunk go in the new one
+        // instead.
+        if (!t->lens.empty() && nback > 1) {
+            t->lens[k] -= nback - 1;
+            complex<float> separator = SEPARATOR;
+            upload(t, k, t->lens[k] - 1, &separator, 1);
+        }
+        // Carry on from the last piece, as tessellate_chunks() would, in as
+        // many new chunks as it takes.
+        vector<complex<float>> rendered;
+        unsigned a = from;
+        do {
+            rendered.clear();
+            tessellate_continue(curve, a, &rendered);
+            unsigned m = min(n - a,
+                    (unsigned)(CHUNK_POINTS - 1 - rendered.size() - 1));
+            rendered.insert(rendered.end(), curve + a, curve + a + m);
+            rendered.push_back(SEPARATOR);
+            t->lens.push_back(rendered.size());
+            upload(t, t->lens.size() - 1, 0, rendered.data(),
+                    rendered.size());
+            a += m;
+        } while (a < n);
+    }
+    t->ends.resize(t->ncurves);
+    t->ends[c] = {t->lens.size() - 1, t->lens.back()};
+    show(t);
+}
+// Forget every curve that could be redone, along with its foreground, which is
+// at the end of its tile's chunks.
+void forget_redo(void)
+{
+    for (tiles::tile *t : g_redo) {
+        tiles::drop_undone(t);
+        if (t->lens.empty())
+            continue;  // not tessellated yet
+        if (t->ncurves == 0) {
+            trim(t, 0, 0);
+        } else {
+            pair<unsigned, unsigned> e = t->ends[t->ncurves - 1];
+            trim(t, e.first + 1, e.second);
+        }
+        t->ends.resize(t->ncurves);
+        show(t);
+    }
+    g_redo.clear();
+}
+
+// Make t's curve i, which is about to be erased, disappear from the
+// foreground, by turning all of its points into separators, so that none of
+// its segments are drawn. Only its own points are uploaded.
+void erase_foreground(tiles::tile *t, unsigned i)
+{
+    if (t->lens.empty())
+        return;  // not tessellated yet
+    pair<unsigned, unsigned> a = i == 0? make_pair(0u, 0u) : t->ends[i - 1];
+    pair<unsigned, unsigned> b = t->ends[i];
+    vector<complex<float>> separators;
+    for (unsigned k = a.first; k <= b.first; k++) {
+        unsigned first = k == a.first? a.second : 0;
+        unsigned end = k == b.first? b.second : t->lens[k];
+        separators.assign(end - first, SEPARATOR);
+        upload(t, k, first, separators.data(), separators.size());
+        t->dead += end - first;
+    }
+    // The curve after it, if any, now starts where it did.
+    t->ends.erase(t->ends.begin() + i);
+}
+// Erase every curve the eraser touches on its way from s0 to s1, on the
+// screen. The curves near it are looked up in the index of each visible tile.
+// See tiles::curves_near().
+void erase_along(complex<float> s0, complex<float> s1)
+{
+    complex<float> p0 = screen_to_board(s0), p1 = screen_to_board(s1);
+    vector<unsigned> hits;
+    for (auto& v : g_visible) {
+        tiles::tile *t = v.first;
+        poincare::mobius f = inverse(compose(g_view, v.second));
+        complex<float> q0 = image(f, p0), q1 = image(f, p1);
+        hits.clear();
+        tiles::curves_near(t, q0, q1, ERASE_RADIUS*(1 - norm(q1)), &hits);
+        // Last first, so that the rest keep their numbers.
+        for (unsigned k = hits.size(); k-- > 0; ) {
+            erase_foreground(t, hits[k]);
+            erase_curve(&g_history, t, hits[k]);
+            journal::erase(t, hits[k]);
+        }
+        if (!hits.empty()) {
+            compact_foreground(t);
+            show(t);
+        }
+    }
+}
+// Tessellate t's curves from curve c on, which have just been added after the
+// rest, and append them to its foreground, as refresh_foreground() would have.
+// t mustn't have any undone curves.
+void append_foreground(tiles::tile *t, unsigned c)
+{
+    // What is already in the last chunk is left where it is, and only stood
+    // in for here, so that tessellate_chunks() knows how much room is left.
+    vector<vector<complex<float>>> rendered;
+    unsigned base = 0, first = 0;
+    if (!t->lens.empty()) {
+        base = t->lens.size() - 1;
+        first = t->lens.back();
+        rendered.emplace_back(first);
+    }
+    t->ends.resize(t->ncurves);
+    tessellate_chunks(t->points, t->starts + c, t->ncurves - c,
+            CHUNK_POINTS - 1, &rendered, t->ends.data() + c);
+    for (unsigned i = c; i < t->ncurves; i++)
+        t->ends[i].first += base;
+    for (unsigned i = 0; i < rendered.size(); i++) {
+        if (base + i == t->lens.size())
+            t->lens.push_back(0);
+        t->lens[base + i] = rendered[i].size();
+        unsigned from = i == 0? first : 0;
+        upload(t, base + i, from, rendered[i].data() + from,
+                rendered[i].size() - from);
+    }
+}
+// Make t's foreground at level of detail l from its curves as they are now,
+// and hand it over.
+void refresh_lod(tiles::tile *t, unsigned l)
+{
+    vector<complex<float>> points;
+    vector<unsigned> starts;
+    tiles::simplify(t, LOD_TOLERANCE*pow(LOD_FACTOR, l - 1), LINE_WIDTH,
+            &points, &starts);
+    input::update u = {input::LOD};
+    u.tile = t;
+    u.n = l;
+    u.version = t->version;
+    tessellate_curves(points.data(), starts.data(), starts.size() - 1,
+            &u.points);
+    t->lod_versions[l - 1] = t->version;
+    publish(std::move(u));
+}
+// Make the levels of detail that the visible tiles will be drawn at, if they
+// aren't made already, as far as LOD_POINTS goes, and return whether there are
+// any left to make. A tile that has changed since the last round is left until
+// the next, since it is likely being drawn in, or erased, or what have you,
+// and simplifying it again every round until that stops would be a waste.
+bool refresh_lods(void)
+{
+    unsigned budget = LOD_POINTS;
+    bool more = false;
+    for (auto& v : g_visible) {
+        tiles::tile *t = v.first;
+        if (t->ncurves == 0)
+            continue;
+        int l = lod_level(t->radius, compose(g_view, v.second));
+        t->lod_versions.resize(LOD_LEVELS);
+        if (l <= 0 || t->lod_versions[l - 1] == t->version)
+            continue;
+        if (t->seen_version != t->version) {
+            t->seen_version = t->version;
+            more = true;
+        } else if (budget > 0) {
+            refresh_lod(t, l);
+            budget -= min(budget, t->starts[t->ncurves]);
+        } else {
+            more = true;
+        }
+    }
+    return more;
+}
+// Once most of t's foreground is erased curves, tessellate it over again
+// without them, so that the chunks don't fill up with them. This takes time in
+// proportion to what is left, and only happens after at least as much has
+// been erased, so it doesn't add much to the cost of erasing.
+void compact_foreground(tiles::tile *t)
+{
+    unsigned total = 0;
+    for (unsigned len : t->lens)
+        total += len;
+    if (2*t->dead > total)
+        refresh_foreground(t);
+}
+// Cut out whatever is inside the clipping eraser, put at the point p on the
+// board, from the curves of every visible tile. The pieces that are left are
+// new curves, so nothing can be redone after this.
+void clip_at(complex<float> p)
+{
+    vector<unsigned> hits;
+    for (auto& v : g_visible) {
+        tiles::tile *t = v.first;
+        // The eraser is a hyperbolic disc, so it is a disc in t-local
+        // coordinates too, though its centre there isn't the image of p.
+        poincare::mobius f = inverse(compose(g_view, v.second));
+        complex<float> e = image(f, p);
+        float R = tanh(g_clip_radius/2), k = 1 - R*R*norm(e);
+        tiles::disc d = {e*(1 - R*R)/k, R*(1 - norm(e))/k};
+        hits.clear();
+        tiles::curves_near(t, d.c, d.c, d.r, &hits);
+        if (hits.empty())
+            continue;
+        forget_redo();
+        unsigned n = t->ncurves;
+        if (!clip_curves(&g_history, t, &hits, d))
+            continue;
+        // Last first, so that the rest keep their numbers.
+        for (unsigned j = hits.size(); j-- > 0; )
+            erase_foreground(t, hits[j]);
+        append_foreground(t, n - hits.size());
+        journal::clip(t, hits, d);
+        compact_foreground(t);
+        show(t);
+    }
+}
+// Drag the clipping eraser from where it last clipped to s, on the screen,
+// clipping at steps of half its radius along the way, so that it sweeps out
+// everything in between. It doesn't clip again until it has moved a quarter of
+// its radius, so the work done depends on how far it goes, and not on how
+// many mouse events it takes to get there.
+void clip_along(complex<float> s)
+{
+    complex<float> p = g_clip_cursor = screen_to_board(s);
+    poincare::mobius f = poincare::translation(g_clip_last);
+    complex<float> w = image(inverse(f), p);
+    double dist = 2*atanh(abs(w));
+    if (dist < g_clip_radius/4)
+        return;
+    unsigned n = ceil(dist/(g_clip_radius/2));
+    for (unsigned i = 1; i <= n; i++)
+        clip_at(image(f, w/abs(w)*(float)tanh(dist*i/n/2)));
+    g_clip_last = p;
+}
+
+// If the view has wandered out of its tile, move it into the tile it is now
+// in, so that g_view stays small.
+void recentre_view(void)
+{
+    complex<double> c = image(inverse(g_view), complex<double>(0));
+    tiles::tile *t = tiles::locate(g_view_tile, &c);
+    if (t == g_view_tile)
+        return;
+
+    poincare::mobius f = tiles::relative(g_view_tile, t);
+    g_view = compose(g_view, f);
+    g_pan_view = compose(g_pan_view, f);
+    g_view_tile = t;
+    refresh_visible();
+}
+
+// The same as recentre_view(), but for the background, which uses the
+// symmetries of its own tiling rather than those of the tiles.
+void recentre_background(void)
+{
+    for (;;) {
+        complex<double> c = image(inverse(g_background_view),
+                complex<double>(0));
+        int k = poincare::nearer_centre(g_p, g_q, c);
+        if (k == -1)
+            return;
+        poincare::mobius f = poincare::edge_turn(g_p, g_q, k);
+        g_background_view = compose(g_background_view, f);
+        g_pan_background = compose(g_pan_background, f);
+        g_turn = compose(g_turn, f);
+    }
+}
+
+// Find the tiles close enough to the view tile to be worth drawing.
+void refresh_visible(void)
+{
+    g_visible.clear();
+    for (tiles::tile *t : tiles::inked()) {
+        poincare::mobius f;
+        if (tiles::within(g_view_tile, t, CULL_DISTANCE + t->radius, &f)) {
+            g_visible.push_back({t, f});
+            // Tiles from a board file aren't tessellated until they are
+            // needed.
+            if (t->lens.empty() && t->ncurves + t->nundone > 0)
+                refresh_foreground(t);
         }
-        // The last point requires a cap.
-        complex<float> r0 = curve[N - 1];
-        complex<float> shape0[4];
-        for (unsigned i = 0; i < 4; i++)
-            shape0[i] = shape[i]*(1 - norm(r0));
-        rendered.push_back(r0 + shape0[0]);
-        rendered.push_back(r0 + shape0[1]);
-        rendered.push_back(r0 + shape0[3]);
-        rendered.push_back(r0 + shape0[2]);
-
-        // Stitching: Repeat the first and last vertices of every curve so that
-        // two zero-area triangles are "drawn" from the end of one curve to the
-        // beginning of the next.  Do this so that the entire foreground can be
-        // drawn in a single OpenGL draw call.
-        rendered[first_stitch_i] = rendered[first_stitch_i + 1];
-        rendered.push_back(rendered.back());
-    }
-
-    // set g_foreground_len.
-    g_foreground_len = rendered.size();
-    assert(g_foreground_len <= g_foreground_max);
-    glBindBuffer(GL_ARRAY_BUFFER, g_foreground_vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0,
-            rendered.size()*8, rendered.data());
+    }
+    g_changed |= DIRTY_VISIBLE;
+}
+
+// Upload the outline of the clipping eraser, which is a circle about the
+// origin of hyperbolic radius g_clip_radius.
+void refresh_eraser(void)
+{
+    complex<float> outline[CLIP_VERTS];
+    float R = tanh(g_shown.clip_radius/2);
+    for (unsigned i = 0; i < CLIP_VERTS; i++)
+        outline[i] = polar(R, (float)(TAU*i/CLIP_VERTS));
+    glBindBuffer(GL_ARRAY_BUFFER, g_eraser_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(outline), outline, GL_STATIC_DRAW);
 }
 
 void refresh_background(void)
 {
-    // Make the vertex data.
-    complex<float> *background_data;
-    poincare::tiling(g_p, g_q, g_res, g_niter,
-            &background_data, &g_background_len);
+    // The edge of the reference polygon's triangle. See glsl/tiling.frag.
+    // It is an arc of a circle that meets the edge of the disc at right
+    // angles, and passes through the midpoint of edge q - 1.
+    double d, m;
+    poincare::reference_polygon(g_shown.p, g_shown.q, &d, &m);
+    g_tiling_phi = TAU/g_shown.q;
+    g_edge_centre = polar((1 + m*m)/(2*m), TAU/g_shown.q/2);
+    g_edge_radius = (1 - m*m)/(2*m);
+    g_polygon_size = 4*atanh(m);
+
+    // The mesh that is drawn is of the old tiling now, but keeps being drawn
+    // until the new one is ready.
+    if (!g_shown.procedural)
+        start_background();
+}
 
-    // Upload the vertex data in background_data to the video device.
-    glBindBuffer(GL_ARRAY_BUFFER, g_background_vbo);
-    glBufferData(GL_ARRAY_BUFFER, g_background_len*sizeof(complex<float>),
-            background_data, GL_DYNAMIC_DRAW);
-    free(background_data);
+// Start making the background mesh over, around where the view is now. Any
+// mesh that was being made is thrown away.
+void start_background(void)
+{
+    background::request(g_shown.p, g_shown.q, g_shown.res,
+            g_shown.background_view, BACKGROUND_PIXELS*PIXEL_SIZE);
+    g_meshes[1].rel = poincare::identity();
+    g_making = true;
 }
 
-// Give the stew a taste every once in a while.
-bool tasting(void)
+// If the background mesh that was asked for last is ready, upload it and swap
+// it in. If wait, wait for it to be ready.
+void update_background(bool wait)
 {
-    return g_frame_counter == 0;
+    background::mesh b;
+    if (!g_making || !background::collect(wait, &b))
+        return;
+    background_mesh &m = g_meshes[1];
+    m.len = b.points.size();
+    m.rel = compose(m.rel, b.origin);
+    m.centre = b.centre;
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBufferData(GL_ARRAY_BUFFER, m.len*sizeof(complex<float>),
+            b.points.data(), GL_STATIC_DRAW);
+    swap(g_meshes[0], g_meshes[1]);
+    g_making = false;
+    g_dirty |= DIRTY_FRAME;
 }
-int main(int argc, char *argv[])
+
+// Save the board to g_board_file, and start the journal over.
+void write_board(void)
 {
-    // Start up glfw and create window.
-    if (!init()) {
-        printf("Failed to initialise!\n");
+    finish_compacting(true);
+    double t = glfwGetTime();
+    board_state b = {g_history, g_redo, g_view_tile, g_view, g_background_view,
+        journal::generation() + 1};
+    if (save_board(g_board_file, b) && journal::restart(b.generation)) {
+        printf("Saved %s in %.3fms.\n", g_board_file,
+                (glfwGetTime() - t)*1000.);
     } else {
-        const GLFWvidmode *m = glfwGetVideoMode(glfwGetPrimaryMonitor());
-        double T = 1. / (double)m->refreshRate;
-        printf("T = %.3fms\n", T*1000.);
+        fprintf(stderr, "Can't save %s.\n", g_board_file);
+    }
+}
 
-        double t_last_frame = glfwGetTime();
-        while (!glfwWindowShouldClose(g_window)) {  // once per frame.
-            double t;
-            if (tasting())
-                t = glfwGetTime();
+// Start compacting the journal into g_board_file, on a thread of its own, so
+// that the frame loop never waits for the board to be saved. Only the curves
+// that have changed since the board was last saved are copied here.
+void compact_board(void)
+{
+    board_state b = {g_history, g_redo, g_view_tile, g_view, g_background_view,
+        0};
+    journal::compact(g_board_file, b);
+}
+// Once a compaction is done, or once it is if wait, point the tiles that
+// haven't changed since at the board it saved.
+void finish_compacting(bool wait)
+{
+    board_snapshot s;
+    if (journal::compacted(wait, &s)) {
+        remap_board(g_board_file, s);
+        printf("Compacted the journal into %s.\n", g_board_file);
+    }
+}
+
+// Load the board from g_board_file, if there is one yet, along with whatever
+// was journalled after it was saved.
+bool read_board(void)
+{
+    double t = glfwGetTime();
+    board_state b = {{}, {}, g_view_tile, g_view, g_background_view, 0};
+    if (access(g_board_file, F_OK) == 0 && !load_board(g_board_file, &b)) {
+        fprintf(stderr, "%s is not a board file.\n", g_board_file);
+        return false;
+    }
+    char fn[PATH_MAX];
+    snprintf(fn, sizeof(fn), "%s.journal", g_board_file);
+    if (!journal::open(fn, b.generation, &b)) {
+        fprintf(stderr, "Can't journal to %s.\n", fn);
+        return false;
+    }
+    g_history = b.history;
+    g_redo = b.redo;
+    g_view_tile = b.view_tile;
+    g_view = b.view;
+    g_background_view = b.background_view;
+    recentre_view();
+    refresh_visible();
+    g_changed |= DIRTY_VIEW;
+    printf("Loaded %u tiles, %zu curves from %s in %.3fms.\n",
+            (unsigned)tiles::inked().size(), g_history.size(), g_board_file,
+            (glfwGetTime() - t)*1000.);
+    return true;
+}
+
+// Draw frames until the window is to close, and return how many were drawn.
+// The updates come from the input thread, or, if replay, from handling the
+// trace's events here.
+unsigned draw_frames(bool replay, double T)
+{
+    schedule::start(T);
+    unsigned nframes = 0;
+    // Whether the last frame was drawn, and so is waiting to be swapped in,
+    // and whether the replay has anything left to do, besides events.
+    bool drawn = true, more = false;
+    while (!glfwWindowShouldClose(g_window)) {  // once per frame.
+        if (drawn) {
+            latency::mark(latency::SWAP_START);
             // Tell OpenGL that all subsequent OpenGL commands are to happen
-            // after the next buffer swap. This will almost never actually swap
-            // the buffers, and in fact, will return immediately, no matter
-            // what happens.  This will only actually swap buffers if the
-            // drawing took longer than the amount of time we gave it to finish
-            // and we have missed the vsync.
+            // after the next buffer swap. This will almost never actually
+            // swap the buffers, and in fact, will return immediately, no
+            // matter what happens.  This will only actually swap buffers if
+            // the drawing took longer than the amount of time we gave it to
+            // finish and we have missed the vsync.
             glfwSwapBuffers(g_window);
             // Clear the screen with the current glClearColor. OpenGL will
             // block here if the buffers haven't been swapped yet, which is
@@ -460,44 +1690,159 @@ int main(int argc, char *argv[])
             // are indeed swapped before continuing!
             glClear(GL_COLOR_BUFFER_BIT);
             glFinish();  // Also, actually do the thing, like right meow.
-            double t1 = glfwGetTime();
-            if (tasting())
-                printf("Time waiting for vsync: %.3fms.\n",
-                        (t1 - t)*1000.);
-            if (tasting())
-                printf("Frame duration: %.3fms\n\n",
-                        (t1 - t_last_frame)*1000.);
-            t_last_frame = t1;
-            g_frame_counter++;
-
-            //---------------- ***VSYNC*** ----------------
-
-            // OK, the vsync has like /juuuust/ happened. The buffers have just
-            // been swapped for suresiez.  Process events for T - T_RENDER, so
-            // that as many events as possible are used to determine the
-            // content of the next frame.
-            if (tasting())
-                t = glfwGetTime();
-            process_events_for(T - T_RENDER);
-            if (tasting())
-                printf("processEventsFor takes %.3fms.\n", (glfwGetTime() - t)*1000.);
-
-            // We have awoken! It is only T_RENDER seconds before the next
-            // vsync, and we have got a frame to render!  Do all OpenGL drawing
-            // commands. 
-            if (tasting())
-                t = glfwGetTime();
+            latency::mark(latency::SWAP_FINISH);
+            latency::collect();
+        }
+
+        //---------------- ***VSYNC*** ----------------
+
+        // OK, the vsync has like /juuuust/ happened. The buffers have just
+        // been swapped for suresiez.  Wait until the schedule says to
+        // render, and then apply the updates, so that as many events as
+        // possible are used to determine the content of the next frame. A
+        // replay has no vsync to make, and always gives the render the same
+        // budget, so that it always draws the same frames. If the last frame
+        // wasn't drawn, because nothing had changed, there is no vsync to
+        // make either, and nothing to do until there is some input.
+        if (replay) {
+            replay_events_for(T - schedule::budget(), T);
+            more = update_board();
+        } else if (drawn) {
+            schedule::swapped(glfwGetTime());
+            apply_updates_at(schedule::wake());
+        } else {
+            input::wait();
+            apply_updates_at(0);
+        }
+
+        // Bring everything up to date with the updates, all at once. If
+        // nothing has changed, the frame would look just like the last one,
+        // so don't bother.
+        drawn = update(replay);
+        if (drawn) {
+            // We have awoken! It is only just long enough before the next
+            // vsync to render in, and we have got a frame to render!  Do all
+            // OpenGL drawing commands.
+            latency::mark(latency::RENDER_START);
             render();
             glFinish();
-            if (tasting())
-                printf("Draw takes %.3fms.\n", (glfwGetTime() - t)*1000.);
+            latency::mark(latency::RENDER_FINISH);
+            nframes++;
+        } else {
+            latency::mark(latency::SKIP);
+            if (!replay)
+                schedule::idle();
+            else if (trace::finished() && !more)
+                glfwSetWindowShouldClose(g_window, GLFW_TRUE);
+        }
+        if (drawn && !replay)
+            schedule::ready(glfwGetTime());
+    }
+
+    return nframes;
+}
+
+// Usage: infiniboard [--record TRACE | --replay TRACE] [--board BOARD]. See
+// trace.hpp and board.cpp. BOARD is loaded at the start if it exists, every
+// change to it is journalled to BOARD.journal as it happens, and it is saved on
+// W, and at the end.
+int main(int argc, char *argv[])
+{
+    const char *record = NULL, *replay = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--record") == 0 &&
+                replay == NULL) {
+            record = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0 &&
+                record == NULL) {
+            replay = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--board") == 0) {
+            g_board_file = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--record TRACE | --replay TRACE] "
+                    "[--board BOARD]\n", argv[0]);
+            return 1;
         }
     }
 
+    int status = 0;
+    double T;
+    if (replay != NULL && !trace::replay(replay, &T)) {
+        fprintf(stderr, "Can't replay %s.\n", replay);
+        return 1;
+    }
+
+    // The background mesh is made on a thread of its own, which wakes the
+    // render thread up whenever a mesh is ready. See background.hpp.
+    background::start(input::wake);
+
+    // Start up glfw and create window.
+    if (!init(replay != NULL)) {
+        printf("Failed to initialise!\n");
+    } else if (g_board_file != NULL && !read_board()) {
+        status = 1;
+    } else {
+        if (replay == NULL) {
+            const GLFWvidmode *m = glfwGetVideoMode(glfwGetPrimaryMonitor());
+            T = 1. / (double)m->refreshRate;
+        }
+        printf("T = %.3fms\n", T*1000.);
+        if (record != NULL && !trace::record(record, T))
+            fprintf(stderr, "Can't record to %s.\n", record);
+        double t_start = glfwGetTime();
+        unsigned nframes;
+
+        if (replay != NULL) {
+            nframes = draw_frames(true, T);
+        } else {
+            // Hand the GL context over to the render thread, once it has what
+            // there is to draw to begin with, and take input here until the
+            // window is to close. After each round of events, bring the
+            // board up to date and hand the render thread the updates, and
+            // while there is more left to do than there was time for, do it
+            // at least once a frame.
+            bool more = update_board();
+            g_direct = false;
+            input::start(g_window, take_event);
+            glfwMakeContextCurrent(NULL);
+            thread render([&] {
+                glfwMakeContextCurrent(g_window);
+                nframes = draw_frames(false, T);
+                glfwMakeContextCurrent(NULL);
+                // In case it was the render thread that closed the window.
+                glfwPostEmptyEvent();
+            });
+            while (!glfwWindowShouldClose(g_window)) {
+                if (more)
+                    glfwWaitEventsTimeout(T);
+                else
+                    glfwWaitEvents();
+                more = update_board();
+            }
+            // In case the render thread is waiting for input.
+            input::wake();
+            render.join();
+            glfwMakeContextCurrent(g_window);
+            g_direct = true;
+        }
+
+        if (replay != NULL) {
+            printf("Replayed %.3fs of input in %u frames, in %.3fs.\n",
+                    g_replay_t, nframes, glfwGetTime() - t_start);
+        }
+        trace::close();
+        if (g_board_file != NULL)
+            write_board();
+        journal::close();
+    }
+
+    background::stop();
+    latency::report(stdout);
+
     // Destroy window
     glfwDestroyWindow(g_window);
 
     glfwTerminate();
 
-    return 0;
+    return status;
 }
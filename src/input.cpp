@@ -0,0 +1,146 @@
+// vi:fo=qacj com=b\://
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+#include <GLFW/glfw3.h>
+
+#include "input.hpp"
+#include "latency.hpp"
+#include "trace.hpp"
+
+
+namespace input {
+
+// The ring buffer of rounds of updates. The input thread is the only writer of
+// g_head, and next(), on the render thread, the only writer of g_tail, so
+// neither ever waits for the other, unless the ring is full, in which case the
+// input thread waits for room rather than dropping anything. The render thread
+// empties it every frame, so it would have to be held up for a long time for
+// that to happen. Updates are pushed onto g_round, which publish() then swaps
+// into the ring whole, however big it is. next() swaps an empty round back in,
+// so the rounds' room gets used over and over.
+#define RING_SIZE 1024  // a power of 2
+static vector<update> g_ring[RING_SIZE];
+static atomic<unsigned> g_head(0), g_tail(0);
+static vector<update> g_round;
+// For the render thread to sleep on in wait(), while it is empty. The input
+// thread only takes the lock to wake it if it is waiting.
+static mutex g_mutex;
+static condition_variable g_wakeup;
+static atomic<bool> g_waiting(false);
+static bool g_woken = false;
+// What to do with each event. See start().
+static void (*g_handle)(const trace::event &e);
+
+
+static void key_callback(GLFWwindow *window, int key, int scancode,
+        int action, int mods)
+{
+    trace::record_key(key, scancode, action, mods);
+    trace::event e = {latency::now(), trace::KEY};
+    e.key = key;
+    e.scancode = scancode;
+    e.action = action;
+    e.mods = mods;
+    g_handle(e);
+}
+static void cursor_position_callback(GLFWwindow *window, double sx, double sy)
+{
+    trace::record_cursor(sx, sy);
+    trace::event e = {latency::now(), trace::CURSOR};
+    e.x = sx;
+    e.y = sy;
+    g_handle(e);
+}
+static void mouse_button_callback(GLFWwindow *window, int button,
+        int action, int mods)
+{
+    trace::record_button(window, button, action, mods);
+    trace::event e = {latency::now(), trace::BUTTON};
+    e.button = button;
+    e.action = action;
+    e.mods = mods;
+    glfwGetCursorPos(window, &e.x, &e.y);
+    g_handle(e);
+}
+static void window_refresh_callback(GLFWwindow *window)
+{
+    g_handle({latency::now(), trace::REFRESH});
+}
+
+// Start taking in window's input, and passing each event to handle as it comes
+// in. Call this on the input thread.
+void start(GLFWwindow *window, void (*handle)(const trace::event &e))
+{
+    g_handle = handle;
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetCursorPosCallback(window, cursor_position_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+}
+
+// Add u to the updates to hand over at the next publish(). Call this on the
+// input thread.
+void push(update &&u)
+{
+    g_round.push_back(std::move(u));
+}
+// Hand every update pushed since the last time over to the render thread, as
+// one round, and wake it up if it is waiting for them. Call this on the input
+// thread.
+void publish(void)
+{
+    if (g_round.empty())
+        return;
+    unsigned head = g_head.load(memory_order_relaxed);
+    while (head - g_tail.load(memory_order_acquire) == RING_SIZE)
+        this_thread::yield();
+    swap(g_ring[head % RING_SIZE], g_round);
+    // Sequentially consistent, as is wait()'s, so that either this sees that
+    // the render thread is waiting, or it sees the new head.
+    g_head.store(head + 1);
+    if (g_waiting.load()) {
+        lock_guard<mutex> l(g_mutex);
+        g_wakeup.notify_one();
+    }
+}
+
+// If there is a round that the render thread hasn't had yet, swap the oldest
+// into *round, and return true. Whatever was in *round is thrown away. Call
+// this on the render thread.
+bool next(vector<update> *round)
+{
+    unsigned tail = g_tail.load(memory_order_relaxed);
+    if (tail == g_head.load(memory_order_acquire))
+        return false;
+    round->clear();
+    swap(*round, g_ring[tail % RING_SIZE]);
+    g_tail.store(tail + 1, memory_order_release);
+    return true;
+}
+
+// Wait until there is a round that the render thread hasn't had yet, or
+// until wake() is called. Call this on the render thread.
+void wait(void)
+{
+    unique_lock<mutex> l(g_mutex);
+    g_waiting.store(true);
+    while (g_tail.load(memory_order_relaxed) == g_head.load() && !g_woken)
+        g_wakeup.wait(l);
+    g_waiting.store(false);
+    g_woken = false;
+}
+// Make the render thread stop waiting, whether there is input or not, such
+// as when the window is to close.
+void wake(void)
+{
+    lock_guard<mutex> l(g_mutex);
+    g_woken = true;
+    g_wakeup.notify_one();
+}
+
+}
@@ -0,0 +1,81 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <complex>
+#include <utility>
+#include <vector>
+
+#include <GLFW/glfw3.h>
+
+#include "poincare.hpp"
+#include "tiles.hpp"
+#include "trace.hpp"
+
+// Handing the work of input over from the thread that gets it to the thread
+// that renders. glfw only delivers input on the main thread, so that is the
+// input thread, and everything the input does to the board is done there, as
+// each event comes in: finding the curves to erase, clipping, simplifying,
+// looking up tiles, journalling, and tessellating. All that is left for the
+// render thread is what needs the GL context, which is uploading what the input
+// thread worked out, and drawing it. That is handed over as updates, a round
+// of events' worth at a time, on a lock-free ring buffer of rounds, which the
+// render thread empties just before it renders each frame. So however much
+// work the input takes, none of it holds up a frame, and however long a frame
+// takes, none of it holds up the input. A round goes into the ring whole, by
+// publish(), however many updates it has, so that no frame ever shows half of
+// what a round did. When there is nothing to draw, the render thread can wait
+// for a round to come in, which, along with the input thread waiting for room
+// in a full ring, is the only time either thread waits for the other.
+//
+// An event's t is when it happened, by latency::now().
+
+namespace input {
+
+enum kind {
+    MARK,  // an event came in at t; see latency.hpp
+    REFRESH,  // the window needs drawing again
+    VIEW,  // the view is now view, and the background's background_view,
+           // and turn carries the background's coordinates to what they
+           // were at the last VIEW
+    VISIBLE,  // visible is now the tiles close enough to the view tile to be
+              // drawn, along with relative(view tile, tile) for each
+    UPLOAD,  // points go in tile's chunk n, from point first on, and the
+             // chunk is then len points long; a chunk past the last one is a
+             // new one
+    TRIM,  // tile only has n chunks now, and the last of them is len points
+           // long
+    SHOW,  // tile is at version, of radius radius, and is drawn up to point
+           // extent.second of chunk extent.first - 1, or not at all if
+           // extent.first is 0
+    LOD,  // points are tile's foreground at level of detail n, at version
+    TILING,  // the background is the {p, q} tiling, with res points to each
+             // edge, and drawn by the tiling program if procedural
+    ERASER,  // the clipping eraser has radius radius, and is at centre on
+             // the screen, and is shown if shown
+    REPORT,  // report the latencies so far
+};
+
+struct update {
+    kind k;
+    double t;
+    tiles::tile *tile;
+    unsigned n, first, len, version;
+    float radius;
+    std::pair<unsigned, unsigned> extent;
+    std::vector<std::complex<float>> points;
+    poincare::mobius view, background_view, turn;
+    std::vector<std::pair<tiles::tile *, poincare::mobius>> visible;
+    unsigned p, q, res;
+    bool procedural, shown;
+    std::complex<float> centre;
+};
+
+void start(GLFWwindow *window, void (*handle)(const trace::event &e));
+void push(update &&u);
+void publish(void);
+bool next(std::vector<update> *round);
+void wait(void);
+void wake(void);
+
+}
@@ -0,0 +1,913 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "helpers.hpp"
+
+#include "journal.hpp"
+
+
+namespace journal {
+
+// A journal file is a header followed by batches, one per flush(). Each batch
+// is a uint32 size and a uint32 checksum of what follows, followed by size
+// bytes of records. Each record is a byte for its kind, followed by:
+//  CURVE: a tile, then float x, y, its first point
+//  POINT: float x, y, added to the curve of the last CURVE
+//  MOVE:  float x, y, where the last point of the curve of the last CURVE
+//         moves to
+//  UNDO:  nothing; the last curve drawn is undone
+//  REDO:  nothing; the last curve undone is redone
+//  ERASE: a tile, then uint32 i; the tile's curve i is erased
+//  CLIP:  a tile, then float x, y, r, then uint32 n
+//         and uint32 i[n], then uint32 m; whatever of the tile's curves i is
+//         in the disc about x, y of radius r is cut out, leaving the tile with
+//         m curves
+//  VIEW:  the view tile, then double[8], the view and the background's view,
+//         each as a, b
+// where a tile is a uint32 n, followed by the n bytes of its path from the
+// origin (see tiles::path()), all in native byte order, and unaligned. A batch
+// is only replayed if all of it made it to the disk, so a crash in the middle
+// of a write loses at most the last batch, and never leaves a curve half
+// started. A batch that did make it, but doesn't go with the board, isn't
+// replayed at all, and neither is anything after it; see open().
+struct journal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;
+};
+#define JOURNAL_MAGIC "ibjourn"
+#define JOURNAL_VERSION 3
+
+enum kind {
+    CURVE,
+    POINT,
+    UNDO,
+    REDO,
+    ERASE,
+    VIEW,
+    CLIP,
+    MOVE,
+};
+
+static char g_fn[PATH_MAX];
+static int g_fd = -1;
+static unsigned g_generation;
+// The size of the journal file, and the batch that is yet to be written to it.
+static size_t g_size;
+static vector<char> g_batch;
+// Where in the batch the last POINT or MOVE ends, if it is the last record in
+// it, so that moving the point again can just change it.
+static size_t g_point_end = 0;
+
+// The thread that fsyncs the journal, and what it shares with the rest.
+static thread g_syncer;
+static mutex g_lock;
+static condition_variable g_wake;
+static bool g_dirty = false, g_stop = false;
+
+// The thread that compacts the journal, and what it shares with the rest; see
+// compact(). While it is at it, flush() writes to the journal that is to take
+// over, in g_next_fd, as well, and g_next_size is how big that is. These, and
+// g_fd, g_size and g_generation, only change with g_lock held.
+static thread g_compactor;
+static char g_board_fn[PATH_MAX];
+static bool g_compacting = false;
+static atomic<bool> g_compact_done(false);
+static bool g_compact_ok;
+static board_snapshot g_compact_snapshot;
+static int g_next_fd = -1;
+static size_t g_next_size;
+
+
+static uint32_t checksum(const char *x, size_t n)
+{
+    // FNV-1a. This only needs to catch torn writes, not adversaries.
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (uint8_t)x[i])*16777619u;
+    return h;
+}
+
+template<typename T> static void put(T x)
+{
+    const char *p = (const char *)&x;
+    g_batch.insert(g_batch.end(), p, p + sizeof(x));
+}
+static void put_mobius(const poincare::mobius &f)
+{
+    put(real(f.a));
+    put(imag(f.a));
+    put(real(f.b));
+    put(imag(f.b));
+}
+static void put_tile(const tiles::tile *t)
+{
+    static vector<uint8_t> p;
+    tiles::path(t, &p);
+    put((uint32_t)p.size());
+    g_batch.insert(g_batch.end(), p.begin(), p.end());
+}
+template<typename T> static bool get(const char **p, const char *end, T *x)
+{
+    if ((size_t)(end - *p) < sizeof(*x))
+        return false;
+    memcpy(x, *p, sizeof(*x));
+    *p += sizeof(*x);
+    return true;
+}
+static bool get_mobius(const char **p, const char *end, poincare::mobius *f)
+{
+    double x[4];
+    if (!get(p, end, &x))
+        return false;
+    *f = {complex<double>(x[0], x[1]), complex<double>(x[2], x[3])};
+    return true;
+}
+// Read a tile, and look it up. This makes it if it doesn't exist yet, but
+// with nothing in it, which changes nothing.
+static bool get_tile(const char **p, const char *end, tiles::tile **t)
+{
+    uint32_t n;
+    if (!get(p, end, &n) || (size_t)(end - *p) < n)
+        return false;
+    *t = tiles::find((const uint8_t *)*p, n);
+    *p += n;
+    return *t != NULL;
+}
+
+static bool write_all(int fd, const char *x, size_t n)
+{
+    while (n > 0) {
+        ssize_t k = write(fd, x, n);
+        if (k < 0)
+            return false;
+        x += k;
+        n -= k;
+    }
+    return true;
+}
+static bool write_header(int fd, unsigned generation)
+{
+    journal_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+    h.version = JOURNAL_VERSION;
+    h.generation = generation;
+    return write_all(fd, (const char *)&h, sizeof(h));
+}
+
+// Make the renames in fn's directory durable.
+static void sync_dir(const char *fn)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", fn);
+    int fd = ::open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+
+// Wait for something to be written, wait up to JOURNAL_SYNC seconds more for
+// more of it, then fsync it all at once. The fsync happens on a duplicate of
+// the descriptor, so that restart() can swap the file out in the meantime. The
+// journal that is to take over from a compaction is fsynced along with it.
+static void syncer(void)
+{
+    unique_lock<mutex> lock(g_lock);
+    for (;;) {
+        g_wake.wait(lock, [] { return g_dirty || g_stop; });
+        g_wake.wait_for(lock, chrono::duration<double>(JOURNAL_SYNC),
+                [] { return g_stop; });
+        if (!g_dirty)
+            return;  // stopping
+        int fd = dup(g_fd);
+        int next = g_next_fd == -1? -1 : dup(g_next_fd);
+        g_dirty = false;
+        lock.unlock();
+        fdatasync(fd);
+        ::close(fd);
+        if (next != -1) {
+            fdatasync(next);
+            ::close(next);
+        }
+        lock.lock();
+    }
+}
+
+
+// A record, as read back from a batch. Which members mean anything depends on
+// k, as above; t is the tile, and i is the curve of an ERASE, or
+// the curves a CLIP leaves.
+struct record {
+    uint8_t k;
+    tiles::tile *t;
+    complex<float> z;
+    uint32_t i;
+    tiles::disc d;
+    vector<unsigned> cs;
+    poincare::mobius view, background_view;
+};
+
+// Read the records in x, up to end, into rs. Return false if they aren't
+// records at all.
+static bool parse(const char *x, const char *end, vector<record> *rs)
+{
+    while (x < end) {
+        record r;
+        r.t = NULL;
+        get(&x, end, &r.k);
+        switch (r.k) {
+        case CURVE:
+            if (!get_tile(&x, end, &r.t) || !get(&x, end, &r.z))
+                return false;
+            break;
+        case POINT:
+        case MOVE:
+            if (!get(&x, end, &r.z))
+                return false;
+            break;
+        case UNDO:
+        case REDO:
+            break;
+        case ERASE:
+            if (!get_tile(&x, end, &r.t) || !get(&x, end, &r.i))
+                return false;
+            break;
+        case CLIP:
+        {
+            uint32_t n;
+            if (!get_tile(&x, end, &r.t) || !get(&x, end, &r.d.c) ||
+                    !get(&x, end, &r.d.r) || !get(&x, end, &n) ||
+                    (size_t)(end - x) < (size_t)n*sizeof(uint32_t))
+                return false;
+            r.cs.resize(n);
+            for (unsigned k = 0; k < n; k++) {
+                uint32_t j;
+                get(&x, end, &j);
+                r.cs[k] = j;
+            }
+            if (!get(&x, end, &r.i))
+                return false;
+        }
+            break;
+        case VIEW:
+            if (!get_tile(&x, end, &r.t) || !get_mobius(&x, end, &r.view) ||
+                    !get_mobius(&x, end, &r.background_view))
+                return false;
+            break;
+        default:
+            return false;
+        }
+        rs->push_back(r);
+    }
+    return true;
+}
+
+// What check() knows of how the board would be after the records so far: how
+// many curves, and undone ones, each tile they have touched would have, the
+// tile of the curve being drawn, and history and redo. To begin with, history
+// and redo are b's, with drawn on the end of history, and nothing in redo if
+// dropped, so that drawing doesn't cost a copy of them. Anything else copies
+// them here first.
+struct trial {
+    const board_state *b;
+    map<tiles::tile *, pair<unsigned, unsigned>> counts;
+    tiles::tile *t;
+    bool copied, dropped;
+    vector<tiles::tile *> drawn, history, redo;
+};
+static pair<unsigned, unsigned> &count(trial *s, tiles::tile *t)
+{
+    auto it = s->counts.find(t);
+    if (it == s->counts.end())
+        it = s->counts.insert({t, {t->ncurves, t->nundone}}).first;
+    return it->second;
+}
+static void copy(trial *s)
+{
+    if (s->copied)
+        return;
+    s->history = s->b->history;
+    s->history.insert(s->history.end(), s->drawn.begin(), s->drawn.end());
+    if (!s->dropped)
+        s->redo = s->b->redo;
+    s->copied = true;
+}
+static void drop_redo(trial *s)
+{
+    if (s->copied) {
+        for (tiles::tile *u : s->redo)
+            count(s, u).second = 0;
+        s->redo.clear();
+    } else if (!s->dropped) {
+        for (tiles::tile *u : s->b->redo)
+            count(s, u).second = 0;
+    }
+    s->dropped = true;
+}
+// Take t's curve i out of s's history, as forget_curve() in board.cpp does.
+static bool forget(trial *s, tiles::tile *t, unsigned i)
+{
+    for (auto it = s->history.begin(); it != s->history.end(); it++) {
+        if (*it == t && i-- == 0) {
+            s->history.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether rs can be applied to the tiles and b, one after the other, where t
+// is the tile of the curve being drawn, if any. Nothing is changed, so that a
+// batch is either applied whole or not at all.
+static bool check(const vector<record> &rs, const board_state &b,
+        tiles::tile *t)
+{
+    trial s;
+    s.b = &b;
+    s.t = t;
+    s.copied = s.dropped = false;
+    for (const record &r : rs) {
+        if (r.k != POINT && r.k != MOVE && r.k != VIEW)
+            s.t = NULL;
+        switch (r.k) {
+        case CURVE:
+            drop_redo(&s);
+            count(&s, r.t).first++;
+            if (s.copied)
+                s.history.push_back(r.t);
+            else
+                s.drawn.push_back(r.t);
+            s.t = r.t;
+            break;
+        case POINT:
+        case MOVE:
+            if (s.t == NULL)
+                return false;
+            break;
+        case UNDO:
+        {
+            copy(&s);
+            if (s.history.empty())
+                return false;
+            tiles::tile *u = s.history.back();
+            pair<unsigned, unsigned> &c = count(&s, u);
+            if (c.first == 0)
+                return false;
+            c.first--;
+            c.second++;
+            s.history.pop_back();
+            s.redo.push_back(u);
+        }
+            break;
+        case REDO:
+        {
+            copy(&s);
+            if (s.redo.empty())
+                return false;
+            tiles::tile *u = s.redo.back();
+            pair<unsigned, unsigned> &c = count(&s, u);
+            if (c.second == 0)
+                return false;
+            c.first++;
+            c.second--;
+            s.redo.pop_back();
+            s.history.push_back(u);
+        }
+            break;
+        case ERASE:
+        {
+            copy(&s);
+            pair<unsigned, unsigned> &c = count(&s, r.t);
+            if (r.i >= c.first || !forget(&s, r.t, r.i))
+                return false;
+            c.first--;
+        }
+            break;
+        case CLIP:
+        {
+            copy(&s);
+            drop_redo(&s);
+            pair<unsigned, unsigned> &c = count(&s, r.t);
+            unsigned n = r.cs.size();
+            if (c.second != 0 || n > c.first || r.i < c.first - n ||
+                    (n == 0 && r.i != c.first))
+                return false;
+            for (unsigned k = 0; k < n; k++) {
+                if (r.cs[k] >= c.first || (k > 0 && r.cs[k] <= r.cs[k - 1]))
+                    return false;
+            }
+            for (unsigned k = n; k-- > 0; ) {
+                if (!forget(&s, r.t, r.cs[k]))
+                    return false;
+            }
+            s.history.insert(s.history.end(), r.i - (c.first - n), r.t);
+            c.first = r.i;
+        }
+            break;
+        }
+    }
+    return true;
+}
+
+// Apply rs, which check() has passed, to the tiles and *b. *t is the tile of
+// the curve being drawn, if any. The one thing check() can't know without
+// doing it is what a clip leaves behind, so return false if that comes out
+// differently than it did the first time.
+static bool apply(const vector<record> &rs, board_state *b, tiles::tile **t)
+{
+    for (const record &r : rs) {
+        vector<unsigned> cs;
+        switch (r.k) {
+        case CURVE:
+            *t = r.t;
+            for (tiles::tile *u : b->redo)
+                tiles::drop_undone(u);
+            b->redo.clear();
+            tiles::new_curve(*t);
+            tiles::add_point(*t, r.z);
+            b->history.push_back(*t);
+            break;
+        case POINT:
+            tiles::add_point(*t, r.z);
+            break;
+        case MOVE:
+            tiles::move_point(*t, r.z);
+            break;
+        case UNDO:
+            tiles::pop_curve(b->history.back());
+            b->redo.push_back(b->history.back());
+            b->history.pop_back();
+            *t = NULL;
+            break;
+        case REDO:
+            tiles::redo_curve(b->redo.back());
+            b->history.push_back(b->redo.back());
+            b->redo.pop_back();
+            *t = NULL;
+            break;
+        case ERASE:
+            erase_curve(&b->history, r.t, r.i);
+            *t = NULL;
+            break;
+        case CLIP:
+            // The pieces are new curves, so nothing can be redone after this.
+            for (tiles::tile *v : b->redo)
+                tiles::drop_undone(v);
+            b->redo.clear();
+            cs = r.cs;
+            clip_curves(&b->history, r.t, &cs, r.d);
+            if (r.t->ncurves != r.i)
+                return false;
+            *t = NULL;
+            break;
+        case VIEW:
+            b->view_tile = r.t;
+            b->view = r.view;
+            b->background_view = r.background_view;
+            break;
+        }
+    }
+    return true;
+}
+
+// Read the whole of fn into *x, and return a descriptor for it, or -1 if there
+// is no such file.
+static int read_journal(const char *fn, vector<char> *x)
+{
+    x->clear();
+    int fd = ::open(fn, O_RDWR);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    int res_stat = fstat(fd, &st);
+    assert(res_stat == 0);
+    x->resize(st.st_size);
+    size_t n = 0;
+    while (n < x->size()) {
+        ssize_t k = read(fd, x->data() + n, x->size() - n);
+        if (k <= 0)
+            break;
+        n += k;
+    }
+    x->resize(n);
+    return fd;
+}
+// Whether x starts with the header of a journal of the given generation.
+static bool continues(const vector<char> &x, unsigned generation)
+{
+    journal_header h;
+    const char *p = x.data();
+    return get(&p, x.data() + x.size(), &h) &&
+        memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == JOURNAL_VERSION && h.generation == generation;
+}
+// Whether x is nothing but the journal that the board of the given generation
+// was saved from, and so is already in the board: a journal with nothing in
+// it, or one of the generation before.
+static bool superseded(const vector<char> &x, unsigned generation)
+{
+    journal_header h;
+    const char *p = x.data();
+    if (x.size() <= sizeof(journal_header))
+        return true;
+    return get(&p, x.data() + x.size(), &h) &&
+        memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) == 0 &&
+        h.version == JOURNAL_VERSION && h.generation + 1 == generation;
+}
+
+// Read the journal in fn, and if it continues the board of the given
+// generation, replay it on top of the tiles and *b, which have just been
+// loaded from that board. Cut off anything torn off the end by a crash. Either
+// way, keep journalling to fn from there on. Return false if fn can't be
+// written to, or if it has a batch that is whole, but doesn't go with the
+// board. Then neither that batch nor anything after it is replayed, and fn is
+// left as it is, since the only way that can happen is a bug, and what is in
+// it may yet be got back. If a compaction was cut short after it saved the
+// board, the journal that continues it is in fn.next, and takes over from fn.
+// A journal that goes with some other board altogether, such as one the board
+// was rolled back from, is moved aside to fn.stale, and if there is already
+// one of those, false is returned, and both are left as they are.
+bool open(const char *fn, unsigned generation, board_state *b)
+{
+    assert(g_fd == -1);
+    snprintf(g_fn, sizeof(g_fn), "%s", fn);
+
+    vector<char> x;
+    int fd = read_journal(fn, &x);
+    char next[PATH_MAX + 8];
+    snprintf(next, sizeof(next), "%s.next", fn);
+    if (!continues(x, generation)) {
+        vector<char> y;
+        int next_fd = read_journal(next, &y);
+        if (next_fd != -1 && continues(y, generation) &&
+                rename(next, fn) == 0) {
+            sync_dir(fn);
+            if (fd != -1)
+                ::close(fd);
+            fd = next_fd;
+            x.swap(y);
+        } else if (next_fd != -1) {
+            ::close(next_fd);
+        }
+    }
+    // Whatever else is in fn.next is from a compaction that was cut short
+    // before it saved the board, and the board still goes with fn.
+    unlink(next);
+
+    const char *p = x.data(), *end = x.data() + x.size();
+    if (!continues(x, generation)) {
+        // Nothing to replay. If there is a journal, it was already compacted
+        // into the board, or else what is in it may be all there is of some
+        // drawing, so it is kept.
+        if (fd != -1) {
+            ::close(fd);
+            char stale[PATH_MAX + 8];
+            snprintf(stale, sizeof(stale), "%s.stale", fn);
+            if (!superseded(x, generation)) {
+                if (access(stale, F_OK) == 0 || rename(fn, stale) != 0) {
+                    fprintf(stderr, "%s doesn't go with the board, and can't "
+                            "be moved aside to %s.\n", fn, stale);
+                    return false;
+                }
+                sync_dir(fn);
+                fprintf(stderr, "Not replaying %s, as it doesn't go with the "
+                        "board. Moved it aside to %s.\n", fn, stale);
+            }
+        }
+        g_generation = generation;
+        if (!restart(generation))
+            return false;
+        g_syncer = thread(syncer);
+        return true;
+    }
+
+    p += sizeof(journal_header);
+    tiles::tile *t = NULL;
+    for (;;) {
+        uint32_t size, sum;
+        const char *q = p;
+        if (!get(&q, end, &size) || !get(&q, end, &sum) ||
+                (size_t)(end - q) < size || checksum(q, size) != sum)
+            break;
+        vector<record> rs;
+        if (!parse(q, q + size, &rs) || !check(rs, *b, t) ||
+                !apply(rs, b, &t)) {
+            fprintf(stderr, "Can't replay %s: the batch at byte %zu doesn't "
+                    "go with the board.\n", fn, (size_t)(p - x.data()));
+            ::close(fd);
+            return false;
+        }
+        p = q + size;
+    }
+    if (p != end) {
+        if (ftruncate(fd, p - x.data()) != 0) {
+            fprintf(stderr, "Can't cut the torn writes off the end of %s.\n",
+                    fn);
+            ::close(fd);
+            return false;
+        }
+        fprintf(stderr, "Cut %zu bytes of torn writes off the end of %s.\n",
+                (size_t)(end - p), fn);
+    }
+    lseek(fd, 0, SEEK_END);
+    g_fd = fd;
+    g_size = p - x.data();
+    g_generation = generation;
+    g_syncer = thread(syncer);
+    return true;
+}
+
+// Journal a new curve in t, starting with z, in t-local coordinates.
+void curve(const tiles::tile *t, complex<float> z)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)CURVE);
+    put_tile(t);
+    put(z);
+}
+// Journal z being added to the last curve started with curve().
+void point(complex<float> z)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)POINT);
+    put(z);
+    g_point_end = g_batch.size();
+}
+// Journal the last point of the last curve started with curve() moving to z.
+// A point that moves several times in a frame is only journalled once.
+void move(complex<float> z)
+{
+    if (g_fd == -1)
+        return;
+    if (g_point_end == 0 || g_point_end != g_batch.size()) {
+        put((uint8_t)MOVE);
+        put(z);
+        g_point_end = g_batch.size();
+    } else {
+        memcpy(&g_batch[g_point_end - sizeof(z)], &z, sizeof(z));
+    }
+}
+// Journal the last curve drawn being undone.
+void undo(void)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)UNDO);
+}
+// Journal the last curve undone being redone.
+void redo(void)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)REDO);
+}
+
+// Journal t's curve i being erased.
+void erase(const tiles::tile *t, unsigned i)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)ERASE);
+    put_tile(t);
+    put((uint32_t)i);
+}
+// Journal whatever of t's curves cs is in d being cut out, once it has been.
+void clip(const tiles::tile *t, const vector<unsigned> &cs, tiles::disc d)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)CLIP);
+    put_tile(t);
+    put(d.c);
+    put(d.r);
+    put((uint32_t)cs.size());
+    for (unsigned c : cs)
+        put((uint32_t)c);
+    put((uint32_t)t->ncurves);
+}
+// Journal the view moving. Only where it ends up matters, so this need only be
+// called once it has stopped.
+void view(const tiles::tile *view_tile, const poincare::mobius &view,
+        const poincare::mobius &background_view)
+{
+    if (g_fd == -1)
+        return;
+    put((uint8_t)VIEW);
+    put_tile(view_tile);
+    put_mobius(view);
+    put_mobius(background_view);
+}
+
+// Write everything journalled since the last flush() as one batch, and have
+// it fsynced soon. Call once per frame.
+void flush(void)
+{
+    if (g_fd == -1 || g_batch.empty())
+        return;
+    uint32_t head[2] = {(uint32_t)g_batch.size(),
+        checksum(g_batch.data(), g_batch.size())};
+    g_batch.insert(g_batch.begin(), (const char *)head,
+            (const char *)(head + 2));
+    lock_guard<mutex> lock(g_lock);
+    bool ok = write_all(g_fd, g_batch.data(), g_batch.size());
+    if (g_next_fd != -1) {
+        ok = write_all(g_next_fd, g_batch.data(), g_batch.size()) && ok;
+        g_next_size += g_batch.size();
+    }
+    if (!ok)
+        perror(g_fn);
+    g_size += g_batch.size();
+    g_batch.clear();
+    g_point_end = 0;
+    g_dirty = true;
+    g_wake.notify_one();
+}
+
+// How big the journal is, which is a measure of how long it would take to
+// replay.
+size_t size(void)
+{
+    lock_guard<mutex> lock(g_lock);
+    return g_size;
+}
+unsigned generation(void)
+{
+    lock_guard<mutex> lock(g_lock);
+    return g_generation;
+}
+
+
+// Compact the journal into the board, as saving s and restart()ing would, on a
+// thread of its own, and starting with everything journalled since from, which
+// is where the journal ended when s was taken.
+//
+// The journal that is to take over is written to fn.next: first a header of
+// s's generation, then what has been journalled since from, and then, through
+// flush(), everything journalled from then on. Only once that is on the disk
+// is the board saved, and only once the board is on the disk does fn.next
+// take over from fn. A crash before the board is saved leaves the old board
+// and fn; a crash after leaves the new board and fn.next, which open() picks
+// up. Either way, nothing is lost.
+static void compactor(board_snapshot s, size_t from)
+{
+    char next[PATH_MAX + 8];
+    snprintf(next, sizeof(next), "%s.next", g_fn);
+    int fd = ::open(next, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    bool ok = fd != -1 && write_header(fd, s.generation);
+    if (ok) {
+        unique_lock<mutex> lock(g_lock);
+        vector<char> x(g_size - from);
+        ok = pread(g_fd, x.data(), x.size(), from) == (ssize_t)x.size() &&
+            write_all(fd, x.data(), x.size());
+        if (ok) {
+            g_next_fd = fd;
+            g_next_size = sizeof(journal_header) + x.size();
+        }
+    }
+    ok = ok && fsync(fd) == 0;
+    if (ok)
+        sync_dir(next);
+    ok = ok && save_snapshot(g_board_fn, s);
+    if (ok) {
+        sync_dir(g_board_fn);
+        fdatasync(fd);
+        // The board is saved, so fd is the journal that goes with it from
+        // here on, whatever its name; see open().
+        unique_lock<mutex> lock(g_lock);
+        if (rename(next, g_fn) != 0)
+            perror(next);
+        ::close(g_fd);
+        g_fd = fd;
+        g_size = g_next_size;
+        g_generation = s.generation;
+        g_next_fd = -1;
+        lock.unlock();
+        sync_dir(g_fn);
+    } else {
+        fprintf(stderr, "Can't compact %s into %s.\n", g_fn, g_board_fn);
+        {
+            lock_guard<mutex> lock(g_lock);
+            g_next_fd = -1;
+        }
+        if (fd != -1)
+            ::close(fd);
+        unlink(next);
+    }
+    g_compact_ok = ok;
+    g_compact_snapshot = std::move(s);
+    g_compact_done = true;
+}
+
+// Start compacting the journal into the board in board_fn, which b and the
+// tiles are the state of, with the next generation, whatever b's, without
+// holding up the caller. Journalling carries
+// on as usual in the meantime. Collect the result with compacted().
+void compact(const char *board_fn, const board_state &b)
+{
+    if (g_fd == -1 || g_compacting)
+        return;
+    flush();
+    snprintf(g_board_fn, sizeof(g_board_fn), "%s", board_fn);
+    board_snapshot s = snapshot_board(b);
+    s.generation = generation() + 1;
+    g_compacting = true;
+    g_compact_done = false;
+    g_compactor = thread(compactor, std::move(s), size());
+}
+bool compacting(void)
+{
+    return g_compacting;
+}
+// If a compaction is done, or once it is if wait, put the snapshot it saved in
+// *s, and return whether it was saved; see remap_board(). Return false if
+// there is no compaction to collect.
+bool compacted(bool wait, board_snapshot *s)
+{
+    if (!g_compacting || (!wait && !g_compact_done))
+        return false;
+    g_compactor.join();
+    g_compacting = false;
+    *s = std::move(g_compact_snapshot);
+    return g_compact_ok;
+}
+
+// Start over with an empty journal of the given generation, once the board has
+// been saved with that generation. Anything journalled and not yet flushed is
+// dropped, as it's in the board.
+bool restart(unsigned generation)
+{
+    assert(!g_compacting);
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", g_fn, (int)getpid());
+    int fd = ::open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        return false;
+    // The board has to be in place before the journal that follows it, or a
+    // crash could leave a journal with nothing to continue.
+    sync_dir(g_fn);
+    if (!write_header(fd, generation) || fsync(fd) != 0 ||
+            rename(tmp, g_fn) != 0) {
+        ::close(fd);
+        unlink(tmp);
+        return false;
+    }
+    sync_dir(g_fn);
+
+    lock_guard<mutex> lock(g_lock);
+    if (g_fd != -1)
+        ::close(g_fd);
+    g_fd = fd;
+    g_dirty = false;
+    g_size = sizeof(journal_header);
+    g_batch.clear();
+    g_point_end = 0;
+    g_generation = generation;
+    return true;
+}
+
+// Flush and fsync everything, and stop journalling, once any compaction is
+// done.
+void close(void)
+{
+    if (g_fd == -1)
+        return;
+    flush();
+    board_snapshot s;
+    compacted(true, &s);
+    {
+        lock_guard<mutex> lock(g_lock);
+        g_stop = true;
+        g_wake.notify_one();
+    }
+    g_syncer.join();
+    fdatasync(g_fd);
+    ::close(g_fd);
+    g_fd = -1;
+    g_stop = false;
+}
+
+}
@@ -0,0 +1,47 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <stddef.h>
+
+#include <complex>
+
+#include "board.hpp"
+#include "tiles.hpp"
+
+// An append-only journal of every change made to a board since it was last
+// saved, so that nothing is lost if infiniboard dies without saving. Changes
+// are batched up in memory and written once per frame by flush(), and the
+// journal is fsynced by a thread of its own no more than JOURNAL_SYNC seconds
+// after each write, so that the cost of keeping it is proportional to how much
+// is drawn, and the frame loop never waits for the disk.
+//
+// Every journal has a generation, and continues the board saved with the same
+// generation. Saving the board with the next generation and then restart()ing
+// the journal compacts it, or compact() does the same without holding up the
+// frame loop. See board.cpp and journal.cpp.
+
+#define JOURNAL_SYNC .5
+
+namespace journal {
+
+bool open(const char *fn, unsigned generation, board_state *b);
+void curve(const tiles::tile *t, std::complex<float> z);
+void point(std::complex<float> z);
+void move(std::complex<float> z);
+void undo(void);
+void redo(void);
+void erase(const tiles::tile *t, unsigned i);
+void clip(const tiles::tile *t, const vector<unsigned> &cs, tiles::disc d);
+void view(const tiles::tile *view_tile, const poincare::mobius &view,
+        const poincare::mobius &background_view);
+void flush(void);
+size_t size(void);
+unsigned generation(void);
+bool restart(unsigned generation);
+void compact(const char *board_fn, const board_state &b);
+bool compacting(void);
+bool compacted(bool wait, board_snapshot *s);
+void close(void);
+
+}
@@ -0,0 +1,462 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "helpers.hpp"
+
+#include "board.hpp"
+#include "journal.hpp"
+#include "tiles.hpp"
+
+using namespace std;
+
+// Each step runs in a process of its own, like a run of infiniboard, since
+// the tiles can't be unloaded. The first step draws and undoes some curves and
+// then crashes, with a write torn off halfway. The next ones start up from
+// that, check that they got the curves back, and carry on, compacting the
+// journal into the board along the way, in the foreground and in the
+// background, and erasing and clipping curves, and undoing and redoing them
+// across saves. Last, the board is rolled back, out from under its journal.
+
+#define BOARD "/tmp/journal_test.board"
+#define JOURNAL BOARD ".journal"
+
+// Start up as infiniboard does.
+static board_state start(void)
+{
+    board_state b = {{}, {}, tiles::origin(), {1., 0.}, {1., 0.}, 0};
+    if (access(BOARD, F_OK) == 0) {
+        bool loaded = load_board(BOARD, &b);
+        assert(loaded);
+    }
+    bool opened = journal::open(JOURNAL, b.generation, &b);
+    assert(opened);
+    return b;
+}
+
+static void draw(board_state *b, tiles::tile *t, unsigned n)
+{
+    for (tiles::tile *u : b->redo)
+        tiles::drop_undone(u);
+    b->redo.clear();
+    tiles::new_curve(t);
+    tiles::add_point(t, .1f);
+    journal::curve(t, .1f);
+    for (unsigned i = 1; i < n; i++) {
+        complex<float> z = .1f + .01if*(float)i;
+        tiles::add_point(t, z);
+        journal::point(z);
+        // Several frames per curve.
+        if (i % 3 == 0)
+            journal::flush();
+    }
+    journal::flush();
+    b->history.push_back(t);
+}
+
+static void undo(board_state *b)
+{
+    tiles::pop_curve(b->history.back());
+    b->redo.push_back(b->history.back());
+    b->history.pop_back();
+    journal::undo();
+    journal::flush();
+}
+
+static void redo(board_state *b)
+{
+    tiles::redo_curve(b->redo.back());
+    b->history.push_back(b->redo.back());
+    b->redo.pop_back();
+    journal::redo();
+    journal::flush();
+}
+
+static void check(const board_state &b, unsigned ncurves, unsigned npoints)
+{
+    unsigned total = 0;
+    for (tiles::tile *t : tiles::inked())
+        total += t->starts == NULL? 0 : t->starts[t->ncurves];
+    printf("%zu curves, %u points (expected %u, %u)\n", b.history.size(),
+            total, ncurves, npoints);
+    assert(b.history.size() == ncurves && total == npoints);
+}
+
+static void step(void (*f)(void))
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        f();
+        exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void crash(void)
+{
+    board_state b = start();
+    check(b, 0, 0);
+    tiles::tile *far = tiles::neighbour(tiles::neighbour(b.view_tile, 0), 3);
+    draw(&b, b.view_tile, 10);
+    draw(&b, far, 7);
+    undo(&b);
+    undo(&b);
+    redo(&b);
+    draw(&b, far, 5);
+    // Move its last point twice in a frame, and then once in the next.
+    tiles::move_point(far, .2f);
+    journal::move(.2f);
+    tiles::move_point(far, .25f);
+    journal::move(.25f);
+    journal::flush();
+    tiles::move_point(far, .3f);
+    journal::move(.3f);
+    journal::flush();
+    check(b, 2, 15);
+    // Tear a curve of 4 points in half, and die without closing anything.
+    tiles::new_curve(b.view_tile);
+    journal::curve(b.view_tile, .1f);
+    for (unsigned i = 0; i < 3; i++)
+        journal::point(.2f);
+    size_t size = journal::size();
+    journal::flush();
+    int res_truncate = truncate(JOURNAL, size + 20);
+    assert(res_truncate == 0);
+    fflush(stdout);
+    _exit(0);
+}
+
+static void recover(void)
+{
+    board_state b = start();
+    check(b, 2, 15);
+    tiles::tile *far = tiles::neighbour(tiles::neighbour(b.view_tile, 0), 3);
+    assert(far->points[far->starts[far->ncurves] - 1] == .3f);
+    // Compact, and keep going.
+    b.generation = journal::generation() + 1;
+    bool saved = save_board(BOARD, b) && journal::restart(b.generation);
+    assert(saved);
+    tiles::tile *t = tiles::neighbour(b.view_tile, 5);
+    draw(&b, t, 6);
+    check(b, 3, 21);
+    // Cut the middle two points out of it, leaving a piece of three points at
+    // either end.
+    vector<unsigned> cs = {0};
+    tiles::disc d = {.1f + .025if, .01f};
+    bool clipped = clip_curves(&b.history, t, &cs, d);
+    assert(clipped && t->ncurves == 2);
+    journal::clip(t, cs, d);
+    journal::flush();
+    check(b, 4, 21);
+    journal::close();
+}
+
+static void reload(void)
+{
+    board_state b = start();
+    check(b, 4, 21);
+    undo(&b);
+    // Rub out the first curve, which is in the mapped board.
+    vector<unsigned> hits;
+    tiles::curves_near(b.view_tile, .05f + .05if, .15f + .05if, .001f, &hits);
+    assert(hits.size() == 1 && hits[0] == 0);
+    erase_curve(&b.history, b.view_tile, 0);
+    journal::erase(b.view_tile, 0);
+    journal::flush();
+    check(b, 2, 8);
+    journal::close();
+}
+
+static void compact(void)
+{
+    board_state b = start();
+    check(b, 2, 8);
+    b.generation = journal::generation() + 1;
+    bool saved = save_board(BOARD, b) && journal::restart(b.generation);
+    assert(saved);
+    journal::close();
+}
+
+static void stale(void)
+{
+    // The board was saved, but the journal from before it is still around,
+    // as if there was a crash in the middle of write_board(). It's already in
+    // the board, so it mustn't be replayed again.
+    board_state b = start();
+    check(b, 2, 8);
+    journal::close();
+}
+
+static void redo_after_save(void)
+{
+    // Undo, save, and redo. The journal only says to redo the last curve
+    // undone, which is in the board.
+    board_state b = start();
+    check(b, 2, 8);
+    draw(&b, b.view_tile, 4);
+    draw(&b, b.view_tile, 4);
+    undo(&b);
+    b.generation = journal::generation() + 1;
+    bool saved = save_board(BOARD, b) && journal::restart(b.generation);
+    assert(saved);
+    redo(&b);
+    draw(&b, b.view_tile, 3);
+    check(b, 5, 19);
+    journal::close();
+}
+
+static void undone_saved(void)
+{
+    // Save with two curves undone, and redo them after loading it.
+    board_state b = start();
+    check(b, 5, 19);
+    undo(&b);
+    undo(&b);
+    b.generation = journal::generation() + 1;
+    bool saved = save_board(BOARD, b) && journal::restart(b.generation);
+    assert(saved);
+    journal::close();
+}
+
+static void redo_loaded(void)
+{
+    board_state b = start();
+    check(b, 3, 12);
+    redo(&b);
+    redo(&b);
+    check(b, 5, 19);
+    journal::close();
+}
+
+static void background(void)
+{
+    // Compact in the background, drawing while it's at it and after, right
+    // after compacting in the foreground.
+    board_state b = start();
+    check(b, 5, 19);
+    b.generation = journal::generation() + 1;
+    bool saved = save_board(BOARD, b) && journal::restart(b.generation);
+    assert(saved);
+    tiles::tile *far = tiles::neighbour(tiles::neighbour(b.view_tile, 0), 3);
+    draw(&b, b.view_tile, 3);
+    unsigned generation = journal::generation();
+    journal::compact(BOARD, b);
+    assert(journal::compacting());
+    draw(&b, far, 4);
+    board_snapshot s;
+    bool compacted = journal::compacted(true, &s);
+    assert(compacted && !journal::compacting());
+    assert(journal::generation() == generation + 1);
+    remap_board(BOARD, s);
+    // The tile that was drawn in since the snapshot keeps its own curves.
+    assert(b.view_tile->own_starts.empty() && !far->own_starts.empty());
+    // Again, with nothing changed. The view tile moves onto the new file, and
+    // the one it was in, which is renamed over, is let go of.
+    weak_ptr<const void> old = b.view_tile->mapping;
+    journal::compact(BOARD, b);
+    compacted = journal::compacted(true, &s);
+    assert(compacted);
+    remap_board(BOARD, s);
+    s = board_snapshot();
+    assert(old.expired() && b.view_tile->mapping != NULL);
+    draw(&b, b.view_tile, 2);
+    check(b, 8, 28);
+    journal::close();
+}
+
+static void adopt(void)
+{
+    // The board was saved by a compaction, which died before the journal
+    // that goes with it took over.
+    board_state b = start();
+    check(b, 8, 28);
+    assert(access(JOURNAL ".next", F_OK) != 0);
+    journal::close();
+}
+
+static void bad_batch(void)
+{
+    // A whole batch that can't be replayed, as a bug might leave: a curve,
+    // and then a redo with nothing to redo. It's followed by a good one.
+    board_state b = start();
+    check(b, 8, 28);
+    draw(&b, b.view_tile, 2);
+    journal::curve(b.view_tile, .1f);
+    journal::point(.2f);
+    journal::redo();
+    journal::flush();
+    journal::curve(b.view_tile, .1f);
+    journal::flush();
+    journal::close();
+}
+
+static void bad_replay(void)
+{
+    // The replay stops short of the bad batch, without applying any of it,
+    // and leaves the journal alone.
+    struct stat st0, st1;
+    int res_stat = stat(JOURNAL, &st0);
+    assert(res_stat == 0);
+    board_state b = {{}, {}, tiles::origin(), {1., 0.}, {1., 0.}, 0};
+    bool loaded = load_board(BOARD, &b);
+    assert(loaded);
+    bool opened = journal::open(JOURNAL, b.generation, &b);
+    assert(!opened);
+    check(b, 9, 30);
+    res_stat = stat(JOURNAL, &st1);
+    assert(res_stat == 0 && st1.st_size == st0.st_size);
+}
+
+// Make the journal out to be of the generation after the one it is of, as if
+// it went with a later board than the one there is.
+static void later(void)
+{
+    int fd = open(JOURNAL, O_RDWR);
+    assert(fd != -1);
+    uint32_t generation;
+    ssize_t res_read = pread(fd, &generation, sizeof(generation), 12);
+    assert(res_read == sizeof(generation));
+    generation++;
+    ssize_t res_write = pwrite(fd, &generation, sizeof(generation), 12);
+    assert(res_write == sizeof(generation));
+    close(fd);
+}
+
+static void rolled_back(void)
+{
+    // The board was rolled back to before the journal. The journal isn't
+    // replayed, but it isn't thrown away either.
+    struct stat st0, st1;
+    int res_stat = stat(JOURNAL, &st0);
+    assert(res_stat == 0);
+    board_state b = start();
+    check(b, 7, 26);
+    res_stat = stat(JOURNAL ".stale", &st1);
+    assert(res_stat == 0 && st1.st_size == st0.st_size);
+    draw(&b, b.view_tile, 3);
+    journal::close();
+}
+
+static void rolled_back_again(void)
+{
+    // Then again, with the first journal still set aside. It doesn't go over
+    // that one, so nothing starts up, and both are left as they are.
+    struct stat st0, st1, st2, st3;
+    int res_stat = stat(JOURNAL, &st0);
+    assert(res_stat == 0);
+    res_stat = stat(JOURNAL ".stale", &st1);
+    assert(res_stat == 0);
+    board_state b = {{}, {}, tiles::origin(), {1., 0.}, {1., 0.}, 0};
+    bool loaded = load_board(BOARD, &b);
+    assert(loaded);
+    bool opened = journal::open(JOURNAL, b.generation, &b);
+    assert(!opened);
+    res_stat = stat(JOURNAL, &st2);
+    assert(res_stat == 0 && st2.st_size == st0.st_size);
+    res_stat = stat(JOURNAL ".stale", &st3);
+    assert(res_stat == 0 && st3.st_size == st1.st_size);
+}
+
+// Write a copy of the board with len bytes of data at offset off, and check
+// that it doesn't load. The offsets are those of the layout in board.cpp.
+static void check_bad(const void *data, size_t off, size_t len)
+{
+    system("cp " BOARD " " BOARD ".bad");
+    int fd = open(BOARD ".bad", O_WRONLY);
+    assert(fd != -1);
+    ssize_t res_write = pwrite(fd, data, len, off);
+    assert(res_write == (ssize_t)len);
+    close(fd);
+    board_state b;
+    bool loaded = load_board(BOARD ".bad", &b);
+    assert(!loaded);
+    unlink(BOARD ".bad");
+}
+
+static void malformed(void)
+{
+    // Two entries for the same tile: the second tile's path is the first's.
+    char path[16];
+    int fd = open(BOARD, O_RDONLY);
+    assert(fd != -1);
+    ssize_t res_read = pread(fd, path, sizeof(path), 112);
+    assert(res_read == sizeof(path));
+    uint64_t path_offset;
+    res_read = pread(fd, &path_offset, sizeof(path_offset), 112 + 48);
+    assert(res_read == sizeof(path_offset));
+    uint32_t path_length;
+    res_read = pread(fd, &path_length, sizeof(path_length), 112 + 48 + 8);
+    assert(res_read == sizeof(path_length) && path_length > 0);
+    uint32_t ntiles, history_offset[2];
+    res_read = pread(fd, &ntiles, sizeof(ntiles), 12);
+    assert(res_read == sizeof(ntiles) && ntiles == 2);
+    res_read = pread(fd, history_offset, sizeof(history_offset), 104);
+    assert(res_read == sizeof(history_offset));
+    close(fd);
+    check_bad(path, 112 + 48, sizeof(path));
+    // Paths that don't lead anywhere: the second tile's starts across an edge
+    // the origin doesn't have, or goes on past the end of the file.
+    uint8_t nowhere = 7;
+    check_bad(&nowhere, path_offset, sizeof(nowhere));
+    uint32_t too_long = 1000;
+    check_bad(&too_long, 112 + 48 + 8, sizeof(too_long));
+    // A curve of the first tile in history twice, and one of the second not
+    // at all, or the other way around.
+    uint32_t k[2] = {0, 0};
+    check_bad(k, history_offset[0], sizeof(k));
+    k[0] = k[1] = 1;
+    check_bad(k, history_offset[0], sizeof(k));
+
+    // None of that changed anything.
+    board_state b = start();
+    check(b, 2, 8);
+    journal::close();
+}
+
+int main(int argc, const char **argv)
+{
+    unlink(BOARD);
+    unlink(JOURNAL);
+    unlink(JOURNAL ".stale");
+
+    step(crash);
+    step(recover);
+    system("cp " JOURNAL " " JOURNAL ".old");
+    step(reload);
+    step(compact);
+    rename(JOURNAL ".old", JOURNAL);
+    step(stale);
+    step(malformed);
+    step(redo_after_save);
+    step(undone_saved);
+    step(redo_loaded);
+    system("cp " JOURNAL " " JOURNAL ".old");
+    step(background);
+    step(adopt);
+    rename(JOURNAL, JOURNAL ".next");
+    rename(JOURNAL ".old", JOURNAL);
+    step(adopt);
+    step(bad_batch);
+    step(bad_replay);
+    later();
+    step(rolled_back);
+    later();
+    step(rolled_back_again);
+
+    unlink(BOARD);
+    unlink(JOURNAL);
+    unlink(JOURNAL ".stale");
+    printf("ok\n");
+    return 0;
+}
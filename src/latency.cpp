@@ -0,0 +1,179 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <math.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+using namespace std;
+
+#include "latency.hpp"
+
+
+namespace latency {
+
+// The ring buffer of events. mark() is the only writer of g_head and
+// collect() the only writer of g_tail, so as long as mark() is only called
+// from one thread at a time, and likewise collect(), neither ever waits for
+// the other. If the ring fills up because nobody is collecting, events are
+// dropped rather than making mark() wait.
+#define RING_SIZE 4096  // a power of 2
+struct stamp {
+    event e;
+    double t;
+};
+static stamp g_ring[RING_SIZE];
+static atomic<unsigned> g_head(0), g_tail(0);
+static atomic<unsigned> g_dropped(0);
+
+// Histograms have BUCKETS_PER_OCTAVE buckets for every doubling of latency,
+// starting at a microsecond, which is a resolution of about 9%.
+#define BUCKETS_PER_OCTAVE 8
+#define NBUCKETS (24*BUCKETS_PER_OCTAVE)
+#define BUCKET_0 1e-6
+struct histogram {
+    const char *name;
+    unsigned long long n;
+    unsigned long long bucket[NBUCKETS];
+    double max;
+};
+
+enum stage {
+    INPUT_TO_RENDER,  // an input event until the start of the render it's in
+    INPUT_TO_PHOTON,  // an input event until the swap that shows it
+    RENDER,  // render start to finish
+    SWAP,  // waiting for the swap, which is mostly waiting for vsync
+    FRAME,  // swap to swap
+    NSTAGES
+};
+static histogram g_histograms[NSTAGES] = {
+    {"input to render"},
+    {"input to photon"},
+    {"render"},
+    {"swap"},
+    {"frame"},
+};
+
+// What collect() has seen so far: inputs that haven't been rendered yet,
+// inputs that are being rendered, and when the last of everything else
+// happened, or -1 if it hasn't.
+static vector<double> g_pending, g_in_flight;
+static double g_render_start = -1, g_swap_start = -1, g_last_swap = -1;
+
+
+// The time, in seconds, by the clock events are marked with.
+double now(void)
+{
+    return chrono::duration<double>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Record that e just happened.
+void mark(event e)
+{
+    mark(e, now());
+}
+// Record that e happened at t, by now().
+void mark(event e, double t)
+{
+    unsigned head = g_head.load(memory_order_relaxed);
+    if (head - g_tail.load(memory_order_acquire) == RING_SIZE) {
+        g_dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    g_ring[head % RING_SIZE] = {e, t};
+    g_head.store(head + 1, memory_order_release);
+}
+
+
+static void add(stage s, double dt)
+{
+    histogram &h = g_histograms[s];
+    int i = dt <= BUCKET_0? 0 :
+        (int)floor(log2(dt/BUCKET_0)*BUCKETS_PER_OCTAVE);
+    if (i >= NBUCKETS)
+        i = NBUCKETS - 1;
+    h.bucket[i]++;
+    h.n++;
+    if (dt > h.max)
+        h.max = dt;
+}
+
+// The latency that a fraction q of the samples in h are under, rounded up to
+// the top of its bucket.
+static double percentile(const histogram &h, double q)
+{
+    unsigned long long want = ceil(q*h.n), seen = 0;
+    for (int i = 0; i < NBUCKETS; i++) {
+        seen += h.bucket[i];
+        if (seen >= want && seen > 0)
+            return fmin(BUCKET_0*exp2((double)(i + 1)/BUCKETS_PER_OCTAVE),
+                    h.max);
+    }
+    return h.max;
+}
+
+// Empty the ring buffer into the histograms. Call this every frame or so, so
+// that the ring never fills up.
+void collect(void)
+{
+    unsigned tail = g_tail.load(memory_order_relaxed);
+    unsigned head = g_head.load(memory_order_acquire);
+    for (; tail != head; tail++) {
+        stamp s = g_ring[tail % RING_SIZE];
+        switch (s.e) {
+        case INPUT:
+            g_pending.push_back(s.t);
+            break;
+        case RENDER_START:
+            for (double t : g_pending)
+                add(INPUT_TO_RENDER, s.t - t);
+            g_in_flight.insert(g_in_flight.end(),
+                    g_pending.begin(), g_pending.end());
+            g_pending.clear();
+            g_render_start = s.t;
+            break;
+        case RENDER_FINISH:
+            if (g_render_start >= 0)
+                add(RENDER, s.t - g_render_start);
+            break;
+        case SKIP:
+            // The inputs since the last render never make it to the screen.
+            g_pending.clear();
+            break;
+        case SWAP_START:
+            g_swap_start = s.t;
+            break;
+        case SWAP_FINISH:
+            for (double t : g_in_flight)
+                add(INPUT_TO_PHOTON, s.t - t);
+            g_in_flight.clear();
+            if (g_swap_start >= 0)
+                add(SWAP, s.t - g_swap_start);
+            if (g_last_swap >= 0)
+                add(FRAME, s.t - g_last_swap);
+            g_last_swap = s.t;
+            break;
+        }
+    }
+    g_tail.store(tail, memory_order_release);
+}
+
+// Print every histogram's percentiles to f.
+void report(FILE *f)
+{
+    collect();
+    fprintf(f, "%-16s %10s %9s %9s %9s\n",
+            "latency (ms)", "count", "p50", "p99", "max");
+    for (const histogram &h : g_histograms) {
+        fprintf(f, "%-16s %10llu %9.3f %9.3f %9.3f\n", h.name, h.n,
+                percentile(h, .5)*1000., percentile(h, .99)*1000.,
+                h.max*1000.);
+    }
+    unsigned dropped = g_dropped.load(memory_order_relaxed);
+    if (dropped > 0)
+        fprintf(f, "(%u events dropped)\n", dropped);
+}
+
+}
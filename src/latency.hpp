@@ -0,0 +1,33 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <stdio.h>
+
+// Instrumentation for how long it takes for input to reach the screen. Every
+// input event, render, and buffer swap is timestamped with mark(), which is
+// cheap enough to call on every one of them: it only pushes the event onto a
+// lock-free ring buffer. collect() empties the ring and works out per-stage
+// latencies from the events, into histograms that report() prints. An event
+// that is only marked some time after it happened, such as an input event
+// that was passed from another thread, can be marked with the time it
+// happened, by now().
+
+namespace latency {
+
+enum event {
+    INPUT,  // a glfw input callback was called
+    RENDER_START,
+    RENDER_FINISH,  // all of the frame's drawing is done on the GPU
+    SWAP_START,
+    SWAP_FINISH,  // the frame has been swapped onto the screen
+    SKIP,  // nothing changed, so the frame wasn't drawn
+};
+
+double now(void);
+void mark(event e);
+void mark(event e, double t);
+void collect(void);
+void report(FILE *f);
+
+}
@@ -0,0 +1,150 @@
+// vi:fo=qacj com=b\://
+
+#include <assert.h>
+
+#include <cmath>
+#include <complex>
+#include <map>
+#include <vector>
+using namespace std;
+using namespace std::literals;
+
+#include "helpers.hpp"
+
+#include "lazy_tiling.hpp"
+
+
+namespace poincare {
+
+// Polygons are told apart by where their centres land on the hyperboloid
+// model, as in tiles.cpp, where distinct centres are always more than
+// 2*sinh(r) apart, r being the inradius.
+typedef pair<long long, long long> key;
+
+static complex<double> centre(const mobius &g)
+{
+    return 2.*g.a*g.b;
+}
+static key key_of(const lazy_tiling *l, complex<double> c)
+{
+    return key(llround(real(c)*l->key_scale), llround(imag(c)*l->key_scale));
+}
+
+// The polygon with the same centre as g, or -1 if it hasn't been found.
+static int find(const lazy_tiling *l, const mobius &g)
+{
+    complex<double> c = centre(g);
+    key k = key_of(l, c);
+    // c may have rounded into a bucket next to the one the polygon went into.
+    for (long long i = -1; i <= 1; i++) {
+        for (long long j = -1; j <= 1; j++) {
+            auto it = l->index.find(key(k.first + i, k.second + j));
+            if (it != l->index.end() &&
+                    abs(centre(l->polygons[it->second]) - c) <
+                    l->key_tolerance)
+                return it->second;
+        }
+    }
+    return -1;
+}
+static unsigned add(lazy_tiling *l, const mobius &g)
+{
+    unsigned i = l->polygons.size();
+    l->polygons.push_back(g);
+    l->index[key_of(l, centre(g))] = i;
+    return i;
+}
+
+// Whether the polygon g is at least a pixel across in the view, going by the
+// circle around it.
+static bool visible(const lazy_tiling *l, const mobius &g)
+{
+    complex<double> c = image(l->view, image(g, complex<double>(0)));
+    double rho = 2*atanh(min(abs(c), 1 - 1e-16));
+    return tanh((rho + l->R)/2) - tanh((rho - l->R)/2) >= l->pixel;
+}
+
+// Start over on the {p, q} tiling, with res points to an edge, for view, and
+// pixels of size pixel.
+void start_tiling(lazy_tiling *l, unsigned p, unsigned q, unsigned res,
+        const mobius &view, double pixel)
+{
+    assert(res >= 2);
+    assert(2*p + 2*q < p*q);
+    l->p = p;
+    l->q = q;
+    l->pixel = pixel;
+
+    double d, m;
+    reference_polygon(p, q, &d, &m);
+    l->R = 2*atanh(d);
+    double sep = 4*m/(1 - m*m);
+    l->key_scale = 2/sep;
+    l->key_tolerance = sep/4;
+
+    // Each edge is the segment of the imaginary axis half an edge long either
+    // side of the origin, moved out to its midpoint, with its points spread
+    // evenly along it, like poincare::tiling()'s.
+    double e = acosh(cos(M_PI/q)/sin(M_PI/p));
+    l->per_edge = 2*(res - 1);
+    l->edges.clear();
+    l->turns.clear();
+    for (unsigned k = 0; k < q; k++) {
+        complex<double> u = exp(-1i*((k + .5)*TAU/q));
+        complex<double> prev;
+        for (unsigned i = 0; i < res; i++) {
+            double t = e*(2.*i/(res - 1) - 1);
+            complex<double> z = 1i*tanh(t/2);
+            z = u*(z + m)/(1. + m*z);
+            if (i > 0) {
+                l->edges.push_back((complex<float>)prev);
+                l->edges.push_back((complex<float>)z);
+            }
+            prev = z;
+        }
+        l->turns.push_back(edge_turn(p, q, k));
+    }
+
+    // Begin with the polygon the view centre is in.
+    mobius g = identity();
+    complex<double> z = image(inverse(view), complex<double>(0));
+    for (;;) {
+        int k = nearer_centre(p, q, z);
+        if (k == -1)
+            break;
+        g = compose(g, l->turns[k]);
+        z = image(inverse(l->turns[k]), z);
+    }
+    l->origin = g;
+    l->view = compose(view, g);
+    l->polygons.clear();
+    l->index.clear();
+    add(l, identity());
+    l->next = 0;
+}
+
+// Draw up to n more polygons, appending their edges to *y, and return whether
+// there are no more to draw.
+bool continue_tiling(lazy_tiling *l, unsigned n, vector<complex<float>> *y)
+{
+    for (; n > 0 && l->next < l->polygons.size(); n--) {
+        unsigned i = l->next++;
+        mobius g = l->polygons[i];
+        for (unsigned k = 0; k < l->q; k++) {
+            mobius h = compose(g, l->turns[k]);
+            int j = find(l, h);
+            if (j == -1 && visible(l, h))
+                j = add(l, h);
+            // Unless the polygon on the other side got to it first.
+            if (j != -1 && (unsigned)j < i)
+                continue;
+            size_t len = y->size();
+            y->resize(len + l->per_edge);
+            image(g, l->edges.data() + k*l->per_edge, y->data() + len,
+                    l->per_edge);
+        }
+    }
+    return l->next == l->polygons.size();
+}
+
+}
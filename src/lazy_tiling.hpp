@@ -0,0 +1,55 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <complex>
+#include <map>
+#include <vector>
+
+#include "poincare.hpp"
+
+// The {p, q} tiling around a view, rather than around the origin: polygons are
+// found breadth first from the one the view centre is in, by turning across
+// their edges, so the closest, biggest ones come first, and any polygon that
+// the view would make smaller than a pixel is left out, along with everything
+// past it. So there are about as many polygons wherever the view is, and
+// however deep the tiling goes, and they can be handed out a few at a time,
+// for the caller to draw as they come. Each polygon's edges are drawn by the
+// first polygon on either side of them to be drawn, so that none are drawn
+// twice.
+//
+// The output is line segments, like poincare::tiling()'s, in the local
+// coordinates of the polygon the view centre is in, which origin carries to
+// the coordinates of the tiling that the view is of. So they are as precise
+// as they can be wherever the view is.
+
+namespace poincare {
+
+struct lazy_tiling {
+    unsigned p, q;
+    // Carry the start polygon's local coordinates to the tiling's, and to the
+    // screen's disc.
+    mobius origin, view;
+    // The size of a pixel in the screen's disc, and the polygons'
+    // circumradius, in the hyperbolic metric.
+    double pixel, R;
+    // The half turns across each edge of the reference polygon, and its edges,
+    // edge k being the 2*(res - 1) points from edges[k*per_edge] on.
+    vector<mobius> turns;
+    vector<complex<float>> edges;
+    unsigned per_edge;
+    // The polygons found so far, in the start polygon's local coordinates,
+    // in the order they were found, and an index
+    // of their centres, as tiles.cpp keeps them. The polygons before next
+    // have been drawn.
+    vector<mobius> polygons;
+    map<pair<long long, long long>, unsigned> index;
+    double key_scale, key_tolerance;
+    unsigned next;
+};
+
+void start_tiling(lazy_tiling *l, unsigned p, unsigned q, unsigned res,
+        const mobius &view, double pixel);
+bool continue_tiling(lazy_tiling *l, unsigned n, vector<complex<float>> *y);
+
+}
@@ -0,0 +1,108 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "helpers.hpp"
+
+#include "lazy_tiling.hpp"
+#include "poincare.hpp"
+
+using namespace std;
+
+// Check that every point of a lazy tiling is on an edge of the tiling, that no
+// edge is drawn twice, that it comes out the same however many polygons are
+// asked for at a time, and that there are about as many polygons wherever the
+// view is.
+
+// How far z is from the nearest edge of the tiling, give or take, in the
+// hyperbolic metric.
+static double edge_distance(unsigned p, unsigned q, complex<double> z)
+{
+    // A point on an edge can go back and forth across it for ever.
+    for (unsigned i = 0; i < 100; i++) {
+        int k = poincare::nearer_centre(p, q, z);
+        if (k == -1)
+            break;
+        z = image(poincare::edge_turn(p, q, k), z);
+    }
+    double d, m;
+    poincare::reference_polygon(p, q, &d, &m);
+    double s = (1 + m*m)/(2*m), r = (1 - m*m)/(2*m);
+    double best = 1e9;
+    for (unsigned k = 0; k < q; k++) {
+        complex<double> c = polar(s, -(k + .5)*TAU/q);
+        double sinh_d = abs(norm(z - c) - r*r)/(r*(1 - norm(z)));
+        best = min(best, asinh(sinh_d));
+    }
+    return best;
+}
+
+static unsigned check(unsigned p, unsigned q, unsigned res,
+        const poincare::mobius &view, double pixel)
+{
+    poincare::lazy_tiling l;
+    vector<complex<float>> y, y1;
+    poincare::start_tiling(&l, p, q, res, view, pixel);
+    while (!poincare::continue_tiling(&l, 7, &y))
+        ;
+    poincare::start_tiling(&l, p, q, res, view, pixel);
+    assert(poincare::continue_tiling(&l, ~0u, &y1));
+    bool same = y == y1;
+
+    // Points out where the view makes them smaller than a pixel aren't worth
+    // checking; float can't say where they are to within an edge anyway.
+    double worst = 0;
+    for (complex<float> z : y) {
+        complex<double> s = image(l.view, (complex<double>)z);
+        if (abs(s) < .9)
+            worst = max(worst, edge_distance(p, q, z));
+    }
+
+    vector<pair<float, float>> mids;
+    for (size_t i = 0; i < y.size(); i += 2*(res - 1)) {
+        complex<float> c = (y[i] + y[i + 2*(res - 1) - 1])/2.f;
+        mids.push_back({real(c), imag(c)});
+    }
+    sort(mids.begin(), mids.end());
+    unsigned twice = 0;
+    for (size_t i = 0; i + 1 < mids.size(); i++) {
+        complex<float> a(mids[i].first, mids[i].second);
+        for (size_t j = i + 1; j < mids.size() &&
+                mids[j].first - mids[i].first < 1e-6; j++) {
+            if (abs(a - complex<float>(mids[j].first, mids[j].second)) <
+                    1e-6)
+                twice++;
+        }
+    }
+
+    unsigned n = l.polygons.size();
+    printf("{%u, %u}, res %u, view %.1f out: %u polygons, %zu vertices, "
+            "error %.2g, %u twice, %s\n", p, q, res,
+            2*atanh(abs(view.b/view.a)), n, y.size(), worst, twice,
+            same? "ok" : "MISMATCH");
+    assert(same);
+    assert(worst < 1e-3);
+    assert(twice == 0);
+    return n;
+}
+
+int main(int argc, const char **argv)
+{
+    double pixel = 2./700;
+    unsigned pq[][2] = {{3, 7}, {4, 5}, {7, 3}, {5, 6}};
+    for (auto& t : pq) {
+        unsigned p = t[0], q = t[1];
+        unsigned n0 = check(p, q, 5, poincare::identity(), pixel);
+        // Somewhere out that the mesh around the origin would never reach.
+        poincare::mobius far = compose(poincare::rotation(polar(1., 2.)),
+                poincare::translation(-.9999));
+        unsigned n1 = check(p, q, 3, far, pixel);
+        assert(n1 > n0/2 && n1 < 2*n0);
+    }
+    return 0;
+}
@@ -20,6 +20,151 @@ complex<float> S(complex<float> a, complex<float> x)
 }
 
 
+// The tilings below spend nearly all of their time mapping big blocks of
+// points through one transform or another, so those loops are split up among
+// the worker threads with parallel_for(), and each thread's share goes through
+// the vector kernels in poincare_simd.cpp. Every point is still computed by
+// exactly the same expression, so the result doesn't depend on how many
+// threads there are.
+
+// y = f*x.
+static void rotate_block(complex<float> f, const complex<float> *x,
+        complex<float> *y, unsigned n)
+{
+    parallel_for(n, [=](unsigned u0, unsigned u1) {
+        rotate_array(f, x + u0, y + u0, u1 - u0);
+    });
+}
+// m copies of x, one after another in y, the a'th of which is rotated by
+// R^(k + a).
+static void rotations(complex<float> R, unsigned k, unsigned m,
+        const complex<float> *x, unsigned n, complex<float> *y)
+{
+    DEF_ARRAY(complex<float>, f, m);
+    for (unsigned a = 0; a < m; a++)
+        f[a] = pow(R, (float)(k + a));
+    parallel_for(m*n, [=](unsigned v0, unsigned v1) {
+        // [v0, v1) can straddle copies.
+        while (v0 < v1) {
+            unsigned a = v0/n, u = v0%n;
+            unsigned len = min(n - u, v1 - v0);
+            rotate_array(f[a], x + u, y + v0, len);
+            v0 += len;
+        }
+    });
+    free(f);
+}
+// y = (m00*x + m01)/(m10*x + m11).
+static void mobius_block(complex<float> m00, complex<float> m01,
+        complex<float> m10, complex<float> m11,
+        const complex<float> *x, complex<float> *y, unsigned n)
+{
+    parallel_for(n, [=](unsigned u0, unsigned u1) {
+        mobius_array(m00, m01, m10, m11, x + u0, y + u0, u1 - u0);
+    });
+}
+// y = S(a, x). x and y may be the same.
+static void translate_block(complex<float> a, const complex<float> *x,
+        complex<float> *y, unsigned n)
+{
+    mobius_block(1.f, a, conj(a), 1.f, x, y, n);
+}
+
+
+// Scale f back onto |a|^2 - |b|^2 = 1 so that rounding error doesn't pile up
+// over long chains of compositions.
+static mobius normalise(mobius f)
+{
+    double s = 1/sqrt(norm(f.a) - norm(f.b));
+    return {f.a*s, f.b*s};
+}
+
+mobius identity(void)
+{
+    return {1., 0.};
+}
+// S(a, .) as a mobius.
+mobius translation(complex<double> a)
+{
+    return normalise({1., a});
+}
+// Rotation about the origin by the unit complex number u.
+mobius rotation(complex<double> u)
+{
+    complex<double> h = sqrt(u);
+    return {h/abs(h), 0.};
+}
+// f after g.
+mobius compose(const mobius &f, const mobius &g)
+{
+    return normalise({
+            f.a*g.a + f.b*conj(g.b),
+            f.a*g.b + f.b*conj(g.a)});
+}
+mobius inverse(const mobius &f)
+{
+    return {conj(f.a), -f.b};
+}
+complex<double> image(const mobius &f, complex<double> z)
+{
+    return (f.a*z + f.b)/(conj(f.b)*z + conj(f.a));
+}
+complex<float> image(const mobius &f, complex<float> z)
+{
+    return (complex<float>)image(f, (complex<double>)z);
+}
+
+
+// Facts about the regular q-gon centred at the origin that tile() uses. Its
+// vertices lie at d*exp(-i*k*phi), and the midpoint of edge k, which runs from
+// vertex k to vertex k + 1, lies at m*exp(-i*(k + 1/2)*phi).
+void reference_polygon(unsigned p, unsigned q, double *pd, double *pm)
+{
+    // The circumradius R and inradius r of the polygon, in the hyperbolic
+    // metric, from the hyperbolic right triangle they make with half an edge.
+    double R = acosh(1/(tan(M_PI/p)*tan(M_PI/q)));
+    double r = acosh(cos(M_PI/p)/sin(M_PI/q));
+    *pd = tanh(R/2);
+    *pm = tanh(r/2);
+}
+
+// The half turn about the midpoint of edge k of the reference polygon. This is
+// a symmetry of the {p, q} tiling that swaps the reference polygon with its
+// neighbour across edge k.
+mobius edge_turn(unsigned p, unsigned q, unsigned k)
+{
+    double d, m;
+    reference_polygon(p, q, &d, &m);
+    complex<double> mk = m*exp(-1i*((k + .5)*TAU/q));
+    return compose(translation(mk),
+            compose(rotation(-1.), translation(-mk)));
+}
+
+// If z is closer to the centre of one of the reference polygon's neighbours
+// than it is to the origin, return the edge leading to the closest such
+// neighbour. Otherwise, z is in the reference polygon; return -1.
+int nearer_centre(unsigned p, unsigned q, complex<double> z)
+{
+    double d, m;
+    reference_polygon(p, q, &d, &m);
+    // The neighbours' centres are twice as far away as the edge midpoints.
+    double c = 2*m/(1 + m*m);
+
+    int best = -1;
+    double best_r = abs(z);
+    for (unsigned k = 0; k < q; k++) {
+        complex<double> ck = c*exp(-1i*((k + .5)*TAU/q));
+        // Distance from ck, up to a monotonic function.
+        double r = abs((z - ck)/(1. - conj(ck)*z));
+        if (r < best_r) {
+            best = k;
+            best_r = r;
+        }
+    }
+    return best;
+}
+
+
 void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
         complex<float> **py, unsigned *pny)
 {
@@ -51,8 +196,7 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
     free(ls);
 
     DEF_ARRAY(complex<float>, pi_B, npi);
-    for (unsigned u = 0; u < npi; u++)
-        pi_B[u] = S(d, pi_A[u]);
+    translate_block(d, pi_A, pi_B, npi);
 
 
     // Determine how much room is needed for each of alpha, beta, gamma, and
@@ -87,18 +231,13 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi_B, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < nbeta; u++)
-            pos[u] = D*beta[u];
+        rotate_block(D, beta, pos, nbeta);
         pos += nbeta;
 
-        for (unsigned a = 0; a < q - 4; a++) {
-            for (unsigned u = 0; u < nalpha; u++)
-                pos[u] = pow(D, (float)(a + 2))*alpha[u];
-            pos += nalpha;
-        }
+        rotations(D, 2, q - 4, alpha, nalpha, pos);
+        pos += (q - 4)*nalpha;
 
-        for (unsigned u = 0; u < ngamma; u++)
-            gamma[u] = S(-d, gamma[u]);
+        translate_block(-d, gamma, gamma, ngamma);
 
 
         // delta block
@@ -107,10 +246,8 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
         pos = delta;
 
         COPY_ARRAY(gamma, pos, ngamma); pos += ngamma;
-        for (unsigned u = 0; u < nalpha; u++) {
-            complex<float> z = pow(D, (float)(q - 2))*alpha[u];
-            pos[u] = S(-d, z);
-        }
+        rotate_block(pow(D, (float)(q - 2)), alpha, pos, nalpha);
+        translate_block(-d, pos, pos, nalpha);
 
 
         // beta block
@@ -120,18 +257,13 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi_A, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < ngamma; u++)
-            pos[u] = A*gamma[u];
+        rotate_block(A, gamma, pos, ngamma);
         pos += ngamma;
 
-        for (unsigned a = 0; a < p - 4; a++) {
-            for (unsigned u = 0; u < ndelta; u++)
-                pos[u] = pow(A, (float)(a + 2))*delta[u];
-            pos += ndelta;
-        }
+        rotations(A, 2, p - 4, delta, ndelta, pos);
+        pos += (p - 4)*ndelta;
 
-        for (unsigned u = 0; u < nbeta; u++)
-            beta[u] = S(d, beta[u]);
+        translate_block(d, beta, beta, nbeta);
 
 
         // alpha block
@@ -140,10 +272,8 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
         pos = alpha;
 
         COPY_ARRAY(beta, pos, nbeta); pos += nbeta;
-        for (unsigned u = 0; u < ndelta; u++) {
-            complex<float> z = pow(A, (float)(p - 2))*delta[u];
-            pos[u] = S(d, z);
-        }
+        rotate_block(pow(A, (float)(p - 2)), delta, pos, ndelta);
+        translate_block(d, pos, pos, ndelta);
     }
 
 
@@ -151,11 +281,7 @@ void tiling_usual(unsigned p, unsigned q, unsigned res, unsigned niter,
     unsigned nI = q*nalpha;
     DEF_ARRAY(complex<float>, I, nI);
     complex<float> *pos = I;
-    for (unsigned a = 0; a < q; a++) {
-        for (unsigned u = 0; u < nalpha; u++)
-            pos[u] = pow(D, (float)a)*alpha[u];
-        pos += nalpha;
-    }
+    rotations(D, 0, q, alpha, nalpha, pos);
 
 
     free(pi_A);
@@ -200,8 +326,7 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
     line_strip_to_lines(ls, res, &pi, &npi);
     free(ls);
 
-    for (unsigned u = 0; u < npi; u++)
-        pi[u] = S(d, pi[u]);
+    translate_block(d, pi, pi, npi);
 
 
     // Determine how much room is needed for each of alpha, zeta, gamma, and
@@ -236,18 +361,13 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < npi; u++)
-            pos[u] = D*pi[u];
+        rotate_block(D, pi, pos, npi);
         pos += npi;
 
-        for (unsigned a = 0; a < q - 6; a++) {
-            for (unsigned u = 0; u < nalpha; u++)
-                pos[u] = pow(D, (float)(a + 2))*alpha[u];
-            pos += nalpha;
-        }
+        rotations(D, 2, q - 6, alpha, nalpha, pos);
+        pos += (q - 6)*nalpha;
 
-        for (unsigned u = 0; u < nzeta; u++)
-            pos[u] = pow(D, (float)(q - 4))*zeta[u];
+        rotate_block(pow(D, (float)(q - 4)), zeta, pos, nzeta);
 
 
         // gamma block
@@ -258,12 +378,10 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
         unsigned ncommon = neta - nzeta;
         COPY_ARRAY(eta, pos, ncommon); pos += ncommon;
 
-        for (unsigned u = 0; u < nalpha; u++)
-            pos[u] = pow(D, (float)(q - 4))*alpha[u];
+        rotate_block(pow(D, (float)(q - 4)), alpha, pos, nalpha);
         pos += nalpha;
 
-        for (unsigned u = 0; u < nzeta; u++)
-            pos[u] = pow(D, (float)(q - 3))*zeta[u];
+        rotate_block(pow(D, (float)(q - 3)), zeta, pos, nzeta);
 
 
         // alpha block
@@ -273,8 +391,7 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < ngamma; u++)
-            pos[u] = (A00*gamma[u] + A01)/(A10*gamma[u] + A11);
+        mobius_block(A00, A01, A10, A11, gamma, pos, ngamma);
 
 
         // zeta block
@@ -284,8 +401,7 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < neta; u++)
-            pos[u] = (A00*eta[u] + A01)/(A10*eta[u] + A11);
+        mobius_block(A00, A01, A10, A11, eta, pos, neta);
     }
 
 
@@ -293,11 +409,7 @@ void tiling_3q(unsigned q, unsigned res, unsigned niter,
     unsigned nI = q*nalpha;
     DEF_ARRAY(complex<float>, I, nI);
     complex<float> *pos = I;
-    for (unsigned a = 0; a < q; a++) {
-        for (unsigned u = 0; u < nalpha; u++)
-            pos[u] = pow(D, (float)a)*alpha[u];
-        pos += nalpha;
-    }
+    rotations(D, 0, q, alpha, nalpha, pos);
 
 
     free(pi);
@@ -382,8 +494,7 @@ static void tiling_p3(unsigned p, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < nbeta; u++)
-            pos[u] = (D00*beta[u] + D01)/(D10*beta[u] + D11);
+        mobius_block(D00, D01, D10, D11, beta, pos, nbeta);
 
 
         // epsilon block
@@ -393,8 +504,7 @@ static void tiling_p3(unsigned p, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < nzeta; u++)
-            pos[u] = (D00*zeta[u] + D01)/(D10*zeta[u] + D11);
+        mobius_block(D00, D01, D10, D11, zeta, pos, nzeta);
 
 
         if (in >= niter - 1)
@@ -408,18 +518,13 @@ static void tiling_p3(unsigned p, unsigned res, unsigned niter,
 
         COPY_ARRAY(pi, pos, npi); pos += npi;
 
-        for (unsigned u = 0; u < npi; u++)
-            pos[u] = A*pi[u];
+        rotate_block(A, pi, pos, npi);
         pos += npi;
 
-        for (unsigned a = 0; a < p - 6; a++) {
-            for (unsigned u = 0; u < ndelta; u++)
-                pos[u] = pow(A, (float)(a + 2))*delta[u];
-            pos += ndelta;
-        }
+        rotations(A, 2, p - 6, delta, ndelta, pos);
+        pos += (p - 6)*ndelta;
 
-        for (unsigned u = 0; u < nepsilon; u++)
-            pos[u] = pow(A, (float)(p - 4))*epsilon[u];
+        rotate_block(pow(A, (float)(p - 4)), epsilon, pos, nepsilon);
 
 
         // beta block
@@ -430,12 +535,10 @@ static void tiling_p3(unsigned p, unsigned res, unsigned niter,
         unsigned ncommon = nzeta - nepsilon;
         COPY_ARRAY(zeta, pos, ncommon); pos += ncommon;
 
-        for (unsigned u = 0; u < ndelta; u++)
-            pos[u] = pow(A, (float)(p - 4))*delta[u];
+        rotate_block(pow(A, (float)(p - 4)), delta, pos, ndelta);
         pos += ndelta;
 
-        for (unsigned u = 0; u < nepsilon; u++)
-            pos[u] = pow(A, (float)(p - 3))*epsilon[u];
+        rotate_block(pow(A, (float)(p - 3)), epsilon, pos, nepsilon);
     }
 
 
@@ -453,30 +556,20 @@ static void tiling_p3(unsigned p, unsigned res, unsigned niter,
 
     COPY_ARRAY(pi, pos, npi); pos += npi;
 
-    for (unsigned u = 0; u < npi; u++)
-        pos[u] = A*pi[u];
+    rotate_block(A, pi, pos, npi);
     pos += npi;
 
-    for (unsigned a = 0; a < p - 4; a++) {
-        for (unsigned u = 0; u < ndelta; u++)
-            pos[u] = pow(A, (float)(a + 2))*delta[u];
-        pos += ndelta;
-    }
+    rotations(A, 2, p - 4, delta, ndelta, pos);
+    pos += (p - 4)*ndelta;
 
-    for (unsigned u = 0; u < nepsilon; u++)
-        pos[u] = pow(A, (float)(p - 2))*epsilon[u];
+    rotate_block(pow(A, (float)(p - 2)), epsilon, pos, nepsilon);
 
     // Centre the alpha block on B.
-    for (unsigned u = 0; u < nalpha; u++)
-        I[u] = S(d, I[u]);
+    translate_block(d, I, I, nalpha);
 
     pos = I + nalpha;
     // Copy to the rest of I.
-    for (unsigned a = 1; a < q; a++) {
-        for (unsigned u = 0; u < nalpha; u++)
-            pos[u] = pow(D, (float)a)*I[u];
-        pos += nalpha;
-    }
+    rotations(D, 1, q - 1, I, nalpha, pos);
 
 
     free(pi);
@@ -7,7 +7,38 @@
 
 namespace poincare {
 
+// An orientation-preserving isometry of the disc,
+/// z -> (a z + b)/(conj(b) z + conj(a)),
+// normalised so that |a|^2 - |b|^2 = 1. These are kept in double precision,
+// since they get composed a lot.
+struct mobius {
+    complex<double> a, b;
+};
+
 complex<float> S(std::complex<float> a, complex<float> x);
+
+mobius identity(void);
+mobius translation(complex<double> a);
+mobius rotation(complex<double> u);
+mobius compose(const mobius &f, const mobius &g);
+mobius inverse(const mobius &f);
+complex<double> image(const mobius &f, complex<double> z);
+complex<float> image(const mobius &f, complex<float> z);
+
+// Array versions, in poincare_simd.cpp. x and y may be the same.
+void rotate_array(complex<float> f, const complex<float> *x,
+        complex<float> *y, unsigned n);
+void mobius_array(complex<float> m00, complex<float> m01,
+        complex<float> m10, complex<float> m11,
+        const complex<float> *x, complex<float> *y, unsigned n);
+void image(const mobius &f, const complex<float> *x, complex<float> *y,
+        unsigned n);
+bool use_simd(const char *isa);
+const char *simd_isa(void);
+
+void reference_polygon(unsigned p, unsigned q, double *pd, double *pm);
+mobius edge_turn(unsigned p, unsigned q, unsigned k);
+int nearer_centre(unsigned p, unsigned q, complex<double> z);
 void tiling(unsigned p, unsigned q, unsigned res, unsigned niter,
         complex<float> **py, unsigned *pny);
 
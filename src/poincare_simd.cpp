@@ -0,0 +1,261 @@
+// vi:fo=qacj com=b\://
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <complex>
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_X86 1
+#endif
+
+#include "helpers.hpp"
+
+#include "poincare.hpp"
+
+
+// Array versions of the maps the tilings are built out of. std::complex
+// division goes through a library call that guards against overflow and NaNs,
+// which never happen here since everything is inside the unit disc, so these
+// just use the textbook formulas. The arrays stay interleaved in memory,
+// because that is what gets uploaded to the GPU, but each kernel splits them
+// into real and imaginary vectors as it loads them and works on those.
+//
+// Every version does exactly the same float operations in exactly the same
+// order, so they all give bit-identical results, and a tiling comes out the
+// same on every machine. That is also why this file is built with
+// -ffp-contract=off (see SConscript): the compiler would otherwise fuse some
+// of the multiplies and adds on CPUs that have FMA, and not on others.
+
+namespace poincare {
+
+// m holds the real and imaginary parts of m00, m01, m10, and m11, in that
+// order.
+
+static void rotate_scalar(complex<float> f, const complex<float> *x,
+        complex<float> *y, unsigned n)
+{
+    float fr = real(f), fi = imag(f);
+    for (unsigned u = 0; u < n; u++) {
+        float xr = real(x[u]), xi = imag(x[u]);
+        y[u] = complex<float>(fr*xr - fi*xi, fr*xi + fi*xr);
+    }
+}
+
+static void mobius_scalar(const float *m, const complex<float> *x,
+        complex<float> *y, unsigned n)
+{
+    for (unsigned u = 0; u < n; u++) {
+        float xr = real(x[u]), xi = imag(x[u]);
+        float nr = m[0]*xr - m[1]*xi + m[2], ni = m[0]*xi + m[1]*xr + m[3];
+        float dr = m[4]*xr - m[5]*xi + m[6], di = m[4]*xi + m[5]*xr + m[7];
+        float s = dr*dr + di*di;
+        y[u] = complex<float>((nr*dr + ni*di)/s, (ni*dr - nr*di)/s);
+    }
+}
+
+
+#ifdef HAVE_X86
+
+// The vector kernels are the scalar ones above with float replaced by a
+// vector of W floats, so that W points are done at once. They use GCC's
+// operators on vector types, so all that differs between instruction sets is
+// how the points are loaded and stored.
+//
+// Loading: two vectors' worth of interleaved points, a and b, are split into
+// the even (real) and odd (imaginary) floats of each 128-bit lane. That
+// scrambles the order of the points, but unpacking the results lane by lane
+// on the way out scrambles them right back.
+#define SIMD_KERNELS(isa, V, W, set1) \
+static void rotate_##isa(complex<float> f, const complex<float> *x, \
+        complex<float> *y, unsigned n) \
+{ \
+    V fr = set1(real(f)), fi = set1(imag(f)); \
+    unsigned u = 0; \
+    for (; u + W <= n; u += W) { \
+        V xr, xi; \
+        split(x + u, &xr, &xi); \
+        join(fr*xr - fi*xi, fr*xi + fi*xr, y + u); \
+    } \
+    rotate_scalar(f, x + u, y + u, n - u); \
+} \
+static void mobius_##isa(const float *m, const complex<float> *x, \
+        complex<float> *y, unsigned n) \
+{ \
+    V m0 = set1(m[0]), m1 = set1(m[1]), m2 = set1(m[2]), m3 = set1(m[3]); \
+    V m4 = set1(m[4]), m5 = set1(m[5]), m6 = set1(m[6]), m7 = set1(m[7]); \
+    unsigned u = 0; \
+    for (; u + W <= n; u += W) { \
+        V xr, xi; \
+        split(x + u, &xr, &xi); \
+        V nr = m0*xr - m1*xi + m2, ni = m0*xi + m1*xr + m3; \
+        V dr = m4*xr - m5*xi + m6, di = m4*xi + m5*xr + m7; \
+        V s = dr*dr + di*di; \
+        join((nr*dr + ni*di)/s, (ni*dr - nr*di)/s, y + u); \
+    } \
+    mobius_scalar(m, x + u, y + u, n - u); \
+}
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+static inline void split(const complex<float> *x, __m128 *re, __m128 *im)
+{
+    __m128 a = _mm_loadu_ps((const float *)x);
+    __m128 b = _mm_loadu_ps((const float *)x + 4);
+    *re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    *im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+static inline void join(__m128 re, __m128 im, complex<float> *y)
+{
+    _mm_storeu_ps((float *)y, _mm_unpacklo_ps(re, im));
+    _mm_storeu_ps((float *)y + 4, _mm_unpackhi_ps(re, im));
+}
+SIMD_KERNELS(sse, __m128, 4, _mm_set1_ps)
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+static inline void split(const complex<float> *x, __m256 *re, __m256 *im)
+{
+    __m256 a = _mm256_loadu_ps((const float *)x);
+    __m256 b = _mm256_loadu_ps((const float *)x + 8);
+    *re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    *im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+static inline void join(__m256 re, __m256 im, complex<float> *y)
+{
+    _mm256_storeu_ps((float *)y, _mm256_unpacklo_ps(re, im));
+    _mm256_storeu_ps((float *)y + 8, _mm256_unpackhi_ps(re, im));
+}
+SIMD_KERNELS(avx2, __m256, 8, _mm256_set1_ps)
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+static inline void split(const complex<float> *x, __m512 *re, __m512 *im)
+{
+    __m512 a = _mm512_loadu_ps((const float *)x);
+    __m512 b = _mm512_loadu_ps((const float *)x + 16);
+    *re = _mm512_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    *im = _mm512_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+static inline void join(__m512 re, __m512 im, complex<float> *y)
+{
+    _mm512_storeu_ps((float *)y, _mm512_unpacklo_ps(re, im));
+    _mm512_storeu_ps((float *)y + 16, _mm512_unpackhi_ps(re, im));
+}
+SIMD_KERNELS(avx512, __m512, 16, _mm512_set1_ps)
+#pragma GCC pop_options
+
+#endif  // HAVE_X86
+
+
+struct kernels {
+    const char *isa;
+    void (*rotate)(complex<float> f, const complex<float> *x,
+            complex<float> *y, unsigned n);
+    void (*mobius)(const float *m, const complex<float> *x,
+            complex<float> *y, unsigned n);
+};
+// Best first.
+static const kernels g_all_kernels[] = {
+#ifdef HAVE_X86
+    {"avx512", rotate_avx512, mobius_avx512},
+    {"avx2", rotate_avx2, mobius_avx2},
+    {"sse", rotate_sse, mobius_sse},
+#endif
+    {"scalar", rotate_scalar, mobius_scalar},
+};
+#define NKERNELS (sizeof(g_all_kernels)/sizeof(*g_all_kernels))
+
+static bool supported(const kernels &k)
+{
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(k.isa, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if (strcmp(k.isa, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(k.isa, "sse") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return true;
+}
+
+// The kernels in use, picked the first time they are needed, which may be on
+// any thread. Every thread that gets there first picks the same ones, so it
+// doesn't matter which wins, as long as the pointer itself is atomic.
+static atomic<const kernels *> g_kernels(NULL);
+
+static const kernels *best_kernels(void)
+{
+    const kernels *k = g_kernels;
+    if (k == NULL) {
+        for (unsigned i = 0; i < NKERNELS; i++) {
+            if (supported(g_all_kernels[i])) {
+                k = &g_all_kernels[i];
+                break;
+            }
+        }
+        g_kernels = k;
+    }
+    return k;
+}
+
+// Use the kernels for the named instruction set ("avx512", "avx2", "sse", or
+// "scalar") from now on, instead of the best ones the CPU supports. Return
+// false, and change nothing, if the CPU doesn't support it. NULL goes back to
+// the best. This is only for testing and benchmarking.
+bool use_simd(const char *isa)
+{
+    if (isa == NULL) {
+        g_kernels = NULL;
+        best_kernels();
+        return true;
+    }
+    for (unsigned i = 0; i < NKERNELS; i++) {
+        if (strcmp(g_all_kernels[i].isa, isa) == 0) {
+            if (!supported(g_all_kernels[i]))
+                return false;
+            g_kernels = &g_all_kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// The name of the instruction set in use.
+const char *simd_isa(void)
+{
+    return best_kernels()->isa;
+}
+
+void rotate_array(complex<float> f, const complex<float> *x,
+        complex<float> *y, unsigned n)
+{
+    best_kernels()->rotate(f, x, y, n);
+}
+
+void mobius_array(complex<float> m00, complex<float> m01,
+        complex<float> m10, complex<float> m11,
+        const complex<float> *x, complex<float> *y, unsigned n)
+{
+    float m[8] = {
+        real(m00), imag(m00), real(m01), imag(m01),
+        real(m10), imag(m10), real(m11), imag(m11),
+    };
+    best_kernels()->mobius(m, x, y, n);
+}
+
+void image(const mobius &f, const complex<float> *x, complex<float> *y,
+        unsigned n)
+{
+    mobius_array(complex<float>(f.a), complex<float>(f.b),
+            complex<float>(conj(f.b)), complex<float>(conj(f.a)), x, y, n);
+}
+
+}
@@ -0,0 +1,79 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "helpers.hpp"
+
+#include "poincare.hpp"
+
+using namespace std;
+
+// Check that every instruction set the CPU has gives exactly the same answers
+// as the scalar kernels, in place or not, whatever the length, and that those
+// are close to what std::complex gives.
+
+#define N 1000
+
+static complex<float> random_point(void)
+{
+    float r = sqrt(drand48())*.999f, t = TAU*drand48();
+    return polar(r, t);
+}
+
+static void run(const complex<float> *x, complex<float> *rot,
+        complex<float> *mob, unsigned n, complex<float> f,
+        const complex<float> *m, bool in_place)
+{
+    if (in_place) {
+        COPY_ARRAY(x, rot, n);
+        COPY_ARRAY(x, mob, n);
+        poincare::rotate_array(f, rot, rot, n);
+        poincare::mobius_array(m[0], m[1], m[2], m[3], mob, mob, n);
+    } else {
+        poincare::rotate_array(f, x, rot, n);
+        poincare::mobius_array(m[0], m[1], m[2], m[3], x, mob, n);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    complex<float> x[N], rot0[N], mob0[N], rot[N], mob[N];
+    for (unsigned u = 0; u < N; u++)
+        x[u] = random_point();
+    complex<float> f = polar(1.f, 1.f);
+    // The translation by a.
+    complex<float> a = random_point();
+    complex<float> m[4] = {1.f, a, conj(a), 1.f};
+
+    poincare::use_simd("scalar");
+    run(x, rot0, mob0, N, f, m, false);
+    float err = 0;
+    for (unsigned u = 0; u < N; u++) {
+        err = max(err, abs(rot0[u] - f*x[u]));
+        err = max(err, abs(mob0[u] - poincare::S(a, x[u])));
+    }
+    printf("scalar: max error %g\n", err);
+    assert(err < 1e-5);
+
+    const char *isas[] = {"sse", "avx2", "avx512"};
+    for (const char *isa : isas) {
+        if (!poincare::use_simd(isa)) {
+            printf("%s: not supported\n", isa);
+            continue;
+        }
+        bool same = true;
+        for (unsigned n : {0u, 1u, 7u, 16u, 33u, (unsigned)N}) {
+            for (bool in_place : {false, true}) {
+                run(x, rot, mob, n, f, m, in_place);
+                same = same && memcmp(rot, rot0, n*sizeof(*x)) == 0 &&
+                    memcmp(mob, mob0, n*sizeof(*x)) == 0;
+            }
+        }
+        printf("%s: %s\n", isa, same? "ok" : "MISMATCH");
+        assert(same);
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+// vi:fo=qacj com=b\://
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+using namespace std;
+
+#include "schedule.hpp"
+
+
+namespace schedule {
+
+// The budget is worked out from the last WINDOW frames, a couple of seconds'
+// worth, and only once there have been MIN_FRAMES of them. It is the time
+// that a fraction PERCENTILE of them were ready within, plus MARGIN for the
+// swap itself and for being woken up late. A vsync counts as missed if the
+// swap after it is MISSED_FRAMES frame periods or more after the one before.
+#define WINDOW 128
+#define MIN_FRAMES 16
+#define PERCENTILE .95
+#define MARGIN 1e-3
+#define MISSED_FRAMES 1.5
+
+// The frame period, the last swap, or -1 before the first, and the wake-up
+// deadline of the frame being made.
+static double g_T, g_last_swap = -1, g_deadline;
+// How long each of the last frames took to get ready, from the deadline,
+// frame n in g_ready[n % WINDOW], and how many frames there have been.
+static double g_ready[WINDOW];
+static unsigned g_frames;
+// How many more frames to fall back for, after a missed vsync.
+static unsigned g_cautious;
+static double g_budget;
+
+
+// What to do when there is nothing better to go on.
+static double fallback(void)
+{
+    return g_T/2;
+}
+
+static void update(void)
+{
+    double b = fallback();
+    if (g_frames >= MIN_FRAMES) {
+        double sorted[WINDOW];
+        unsigned n = min(g_frames, (unsigned)WINDOW);
+        copy(g_ready, g_ready + n, sorted);
+        unsigned k = (unsigned)ceil(PERCENTILE*n) - 1;
+        nth_element(sorted, sorted + k, sorted + n);
+        b = sorted[k] + MARGIN;
+        if (g_cautious > 0)
+            b = max(b, fallback());
+    }
+    g_budget = min(b, g_T);
+}
+
+// Start scheduling frames for a display with a frame period of T.
+void start(double T)
+{
+    assert(T > 0);
+    g_T = T;
+    g_last_swap = -1;
+    g_frames = 0;
+    g_cautious = 0;
+    update();
+}
+
+// Record that the buffers were swapped, and the vsync has happened, at t.
+void swapped(double t)
+{
+    if (g_last_swap >= 0 && t - g_last_swap >= MISSED_FRAMES*g_T)
+        g_cautious = WINDOW;
+    else if (g_cautious > 0)
+        g_cautious--;
+    g_last_swap = t;
+    update();
+}
+
+// When to start rendering the frame for the next vsync.
+double wake(void)
+{
+    assert(g_last_swap >= 0);
+    g_deadline = g_last_swap + g_T - g_budget;
+    return g_deadline;
+}
+
+// Record that the frame that was to start at the last wake() was ready to be
+// swapped at t. Whatever held it up counts, including the events that were
+// still being processed when it was meant to start.
+void ready(double t)
+{
+    if (g_last_swap < 0)
+        return;  // it was put off
+    g_ready[g_frames++ % WINDOW] = max(t - g_deadline, 0.);
+    update();
+}
+
+// Record that the frame that was to start at the last wake() is being put off
+// until there is something to draw. There is no telling when that will be, so
+// it is as if there had never been a swap.
+void idle(void)
+{
+    g_last_swap = -1;
+}
+
+// How long before each vsync rendering starts.
+double budget(void)
+{
+    return g_budget;
+}
+
+}
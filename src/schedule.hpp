@@ -0,0 +1,26 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+// When to stop processing events and start rendering each frame. The later
+// that is, the more of the events that happen during a frame make it into the
+// frame, and the fresher it is when it reaches the screen; but the frame still
+// has to be ready before the next vsync, or it is a whole frame late. So the
+// render is started a budget before the vsync that is a high percentile of
+// how long the last few seconds of frames took to get ready, plus a margin.
+// Whenever a vsync is missed anyway, the budget falls back to half a frame for
+// a while, whatever the frames look like they take. Frames that are put off
+// until there is something to draw don't count either way.
+//
+// Times are in seconds, on any one clock, such as glfwGetTime()'s.
+
+namespace schedule {
+
+void start(double T);
+void swapped(double t);
+double wake(void);
+void ready(double t);
+void idle(void);
+double budget(void);
+
+}
@@ -0,0 +1,88 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "schedule.hpp"
+
+// Run frames through the schedule on a made-up clock, as infiniboard would,
+// with the display at a frame period of T, and check that the render budget
+// follows how long the frames take.
+
+static double g_t;
+
+// Run n frames that each take dt to get ready, and return the budget. If a
+// frame isn't ready in time for its vsync, it goes out at the one after.
+static double frames(double T, unsigned n, double dt)
+{
+    for (unsigned i = 0; i < n; i++) {
+        double vsync = schedule::wake() + schedule::budget();
+        g_t = schedule::wake() + dt;
+        schedule::ready(g_t);
+        while (vsync < g_t)
+            vsync += T;
+        g_t = vsync;
+        schedule::swapped(g_t);
+    }
+    return schedule::budget();
+}
+
+static void check(const char *what, double b, double lo, double hi)
+{
+    bool ok = lo <= b && b <= hi;
+    printf("%s: budget %.3fms, %s\n", what, b*1000., ok? "ok" : "WRONG");
+    assert(ok);
+}
+
+static void run(double T)
+{
+    printf("T = %.3fms\n", T*1000.);
+    g_t = 0;
+    schedule::start(T);
+    schedule::swapped(g_t);
+    check("at the start", schedule::budget(), T/2, T/2);
+
+    // Frames need a little more than they take.
+    double b = frames(T, 200, 3e-3);
+    check("slow", b, 3e-3, 5e-3);
+
+    // A few that take longer, but still make it, don't matter.
+    for (unsigned i = 0; i < 3; i++) {
+        frames(T, 1, 3.5e-3);
+        b = frames(T, 30, 3e-3);
+    }
+    check("a few slower", b, 3e-3, 4.2e-3);
+
+    b = frames(T, 200, .3e-3);
+    check("fast", b, .3e-3, 2e-3);
+
+    // A frame that misses its vsync makes it fall back, whatever the frames
+    // after it take, for a while.
+    frames(T, 1, T);
+    b = frames(T, 30, .3e-3);
+    check("after a miss", b, T/2, T);
+    b = frames(T, 200, .3e-3);
+    check("long after a miss", b, .3e-3, 2e-3);
+
+    // A frame that is put off until there is something to draw, and then
+    // drawn straight away, isn't a miss, however long it is put off for.
+    schedule::wake();
+    schedule::idle();
+    g_t += 5;
+    schedule::ready(g_t + .3e-3);
+    g_t += T;
+    schedule::swapped(g_t);
+    b = frames(T, 30, .3e-3);
+    check("after idling", b, .3e-3, 2e-3);
+
+    // Frames that take longer than a frame start right after the swap.
+    b = frames(T, 200, 1.2*T);
+    check("too slow", b, T, T);
+}
+
+int main(int argc, const char **argv)
+{
+    run(1/60.);
+    run(1/144.);
+    return 0;
+}
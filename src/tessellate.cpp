@@ -0,0 +1,95 @@
+// vi:fo=qacj com=b\://
+
+#include <assert.h>
+
+#include <complex>
+#include <vector>
+using namespace std;
+
+#include "helpers.hpp"
+
+#include "tessellate.hpp"
+
+
+// Append the strip for ncurves curves to rendered, which is either empty, or
+// a strip already. Curve i is made of the points from points[starts[i]] up to
+// points[starts[i + 1]], as in struct tiles::tile.
+void tessellate_curves(const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, vector<complex<float>> *rendered)
+{
+    if (rendered->empty())
+        rendered->push_back(SEPARATOR);
+    for (unsigned c = 0; c < ncurves; c++) {
+        rendered->insert(rendered->end(), points + starts[c],
+                points + starts[c + 1]);
+        rendered->push_back(SEPARATOR);
+    }
+}
+
+// Start the strip rendered, which is empty, so that it carries on curve from
+// its first N points, which are at the end of another strip, as a piece of the
+// same curve. The two points before the piece are put in front of it, so that
+// its first segment bends the same way it would have if the curve hadn't been
+// cut.
+void tessellate_continue(const complex<float> *curve, unsigned N,
+        vector<complex<float>> *rendered)
+{
+    assert(rendered->empty());
+    rendered->push_back(N >= 2? curve[N - 2] : SEPARATOR);
+    if (N >= 1)
+        rendered->push_back(curve[N - 1]);
+}
+
+// The same as tessellate_curves(), except that the strip is cut up into
+// chunks of at most max_points points each, which are appended to *chunks. A
+// curve that doesn't fit in what is left of a chunk is cut into pieces, which
+// carry on in the next chunk, as tessellate_continue() does. Set ends[i] to
+// where curve i ends, as the number of its last chunk and the size of that
+// chunk at that point.
+void tessellate_chunks(const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, unsigned max_points,
+        vector<vector<complex<float>>> *chunks,
+        pair<unsigned, unsigned> *ends)
+{
+    // The two points a piece starts with, a point, and a separator.
+    assert(max_points >= 4);
+    for (unsigned c = 0; c < ncurves; c++) {
+        const complex<float> *curve = points + starts[c];
+        unsigned a = 0, n = starts[c + 1] - starts[c];
+        do {
+            if (chunks->empty())
+                chunks->emplace_back();
+            vector<complex<float>> *y = &chunks->back();
+            if (y->empty())
+                tessellate_continue(curve, a, y);
+            // Room for at least one point, and the separator after it.
+            if (max_points - y->size() < 2) {
+                chunks->emplace_back();
+                continue;
+            }
+            unsigned k = min(n - a, (unsigned)(max_points - y->size() - 1));
+            y->insert(y->end(), curve + a, curve + a + k);
+            y->push_back(SEPARATOR);
+            a += k;
+            if (a < n)
+                chunks->emplace_back();
+        } while (a < n);
+        ends[c] = {chunks->size() - 1, chunks->back().size()};
+    }
+}
+
+// The part of the strip that changes when the last curve of a strip made by
+// tessellate_curves() or by earlier calls to this, which had had of its points
+// in the strip, now has N, and those from from on are new or have moved. It
+// may be a brand new curve, with had 0. Set *y to the points that go at the
+// end of the strip, and return how many points of it they replace.
+unsigned tessellate_tail(const complex<float> *curve, unsigned N,
+        unsigned from, unsigned had, vector<complex<float>> *y)
+{
+    assert(from <= had && from <= N);
+    // The strip ends with a separator, which a new curve goes after, and the
+    // points of an old one go in place of, from from on.
+    y->assign(curve + from, curve + N);
+    y->push_back(SEPARATOR);
+    return had == 0? 0 : had - from + 1;
+}
@@ -0,0 +1,35 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <complex>
+#include <vector>
+
+// Laying curves out for the foreground. The GPU does the actual tessellating
+// (see glsl/stroke.vert): each curve is drawn as a cubic spline through its
+// points, one instance per segment, from the points before and after it as
+// well as its own two, so all that is uploaded is the points themselves. The
+// curves of a tile are laid out one after the other in a "strip", each one
+// followed by a SEPARATOR, so that the segments that would join one curve to
+// the next aren't drawn, and a whole tile can be drawn with one draw call.
+// Segments touching a separator are drawn as just a cap at their other end,
+// if that is a point, or not at all if not.
+//
+// Instance i of a strip reads points i to i + 3 of it, so a strip of len
+// points is drawn with len - 2 instances, and the point after the end of it
+// has to be there to be read, though what it is doesn't matter.
+
+#define LINE_WIDTH 0.01f
+// Anything outside the unit disc. The shader has to agree.
+#define SEPARATOR complex<float>(2.f, 0.f)
+
+void tessellate_curves(const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, vector<complex<float>> *rendered);
+void tessellate_chunks(const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, unsigned max_points,
+        vector<vector<complex<float>>> *chunks,
+        pair<unsigned, unsigned> *ends);
+void tessellate_continue(const complex<float> *curve, unsigned N,
+        vector<complex<float>> *rendered);
+unsigned tessellate_tail(const complex<float> *curve, unsigned N,
+        unsigned from, unsigned had, vector<complex<float>> *y);
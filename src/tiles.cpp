@@ -0,0 +1,803 @@
+// vi:fo=qacj com=b\://
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+using namespace std;
+
+#include "helpers.hpp"
+
+#include "tiles.hpp"
+
+
+namespace tiles {
+
+using poincare::mobius;
+
+// The tree of tiles is grown a ring at a time: ring n + 1 is every tile that
+// shares an edge with ring n, and isn't in ring n - 1 or n. With three tiles at
+// every corner, each tile in ring n + 1 shares an edge with either one or two
+// tiles of ring n, and with two tiles of its own ring, one either side, and
+// the rest of its edges are shared with ring n + 2. Every tile but the one at
+// the origin has a parent in the ring before it, across its edge 0:
+//  ONE:  its only neighbour in the ring before. Its own ring is across edges 1
+//        and 6, and the ring after across 2 to 5.
+//  TWO:  the first of two neighbours in the ring before. The other one is
+//        across edge 1, its own ring across 2 and 6, and the ring after across
+//        3 to 5.
+// Edges are numbered so that, of a tile's two parents, the one whose edge to
+// it comes just after its edge to the other one is the parent. So a tile's
+// children are across edges 2 to 4 (ONE) or 3 and 4 (TWO), and across edge 5
+// is a child of the tile across edge 6. Every neighbour of the origin is a
+// child of it, and of kind ONE.
+//
+// Everything across an edge that doesn't lead to a child is found by going
+// around a corner from a tile that is closer to the origin, or from the tile
+// across edge 6, whose child it is; see around(). These rules are for TILE_P
+// == 3 only, and have been checked against the geometry of the tiling.
+static_assert(TILE_P == 3, "the tree of tiles is for three tiles at a corner");
+enum kind {
+    ORIGIN,
+    ONE,
+    TWO,
+};
+
+static tile *g_origin;
+static vector<tile *> g_inked;
+
+
+// Whether edge k of t leads to a child of t.
+static bool leads_to_child(const tile *t, unsigned k)
+{
+    switch (t->kind) {
+    case ORIGIN:
+        return true;
+    case ONE:
+        return k >= 2 && k <= 4;
+    default:
+        return k == 3 || k == 4;
+    }
+}
+
+static void link(tile *t, unsigned k, tile *u, unsigned b)
+{
+    t->nb[k] = u;
+    t->back[k] = b;
+    u->nb[b] = t;
+    u->back[b] = k;
+}
+// Link t to the tile across its edge k, from the tile u across edge k - dir,
+// where dir is 1 or -1. Around the corner t and u share with it, it is the
+// tile across edge b - dir of u, where b is u's edge back to t, and by the
+// same token, t is across its edge c - dir, where c is its edge back to u.
+static void around(tile *t, unsigned k, int dir)
+{
+    unsigned j = (k + TILE_Q - dir) % TILE_Q;
+    tile *u = neighbour(t, j);
+    unsigned i = (t->back[j] + TILE_Q - dir) % TILE_Q;
+    tile *v = neighbour(u, i);
+    link(t, k, v, (u->back[i] + TILE_Q - dir) % TILE_Q);
+}
+
+// The tile at the origin, which is the root of the tree.
+tile *origin(void)
+{
+    if (g_origin == NULL) {
+        g_origin = new tile();
+        g_origin->kind = ORIGIN;
+    }
+    return g_origin;
+}
+
+// The tile across edge k of t.
+tile *neighbour(tile *t, unsigned k)
+{
+    if (t->nb[k] != NULL)
+        return t->nb[k];
+    if (leads_to_child(t, k)) {
+        tile *u = new tile();
+        u->kind = (t->kind == ONE && k == 2) || (t->kind == TWO && k == 3)?
+            TWO : ONE;
+        link(t, k, u, 0);
+    } else if (k >= 5) {
+        around(t, k, -1);
+    } else {
+        around(t, k, 1);
+    }
+    return t->nb[k];
+}
+
+// Set p to t's path from the origin: the edge that leads to each tile on the
+// way from its parent.
+void path(const tile *t, vector<uint8_t> *p)
+{
+    p->clear();
+    for (; t->kind != ORIGIN; t = t->nb[0])
+        p->push_back(t->back[0]);
+    reverse(p->begin(), p->end());
+}
+// The tile at the end of the path p of n edges, as path() makes, or NULL if p
+// isn't the path of any tile.
+tile *find(const uint8_t *p, size_t n)
+{
+    tile *t = origin();
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] >= TILE_Q || !leads_to_child(t, p[i]))
+            return NULL;
+        t = neighbour(t, p[i]);
+    }
+    return t;
+}
+
+// Carries coordinates local to the neighbour across edge k of a tile, whose
+// edge b leads back, to the tile's local coordinates.
+static const mobius &step(unsigned k, unsigned b)
+{
+    static const vector<mobius> steps = [] {
+        vector<mobius> s;
+        for (unsigned k = 0; k < TILE_Q; k++) {
+            for (unsigned b = 0; b < TILE_Q; b++) {
+                s.push_back(compose(poincare::edge_turn(TILE_P, TILE_Q, k),
+                            poincare::rotation(polar(1.,
+                                    -((double)k - b)*TAU/TILE_Q))));
+            }
+        }
+        return s;
+    }();
+    return steps[k*TILE_Q + b];
+}
+
+// Walk from t to the tile containing the point *z, given in t-local
+// coordinates, and convert *z to that tile's local coordinates. Put the
+// transform from that tile's local coordinates to t's in *f. Since the tiling
+// is regular, the tile containing z is the one with the closest centre.
+static tile *walk(tile *t, complex<double> *z, mobius *f)
+{
+    *f = poincare::identity();
+    for (;;) {
+        int k = poincare::nearer_centre(TILE_P, TILE_Q, *z);
+        if (k == -1)
+            return t;
+        tile *u = neighbour(t, k);
+        unsigned b = t->back[k];
+        *f = compose(*f, step(k, b));
+        *z = image(step(b, k), *z);
+        t = u;
+    }
+}
+// Return the tile containing the point *z, given in t-local coordinates, and
+// convert *z to that tile's local coordinates.
+tile *locate(tile *t, complex<double> *z)
+{
+    mobius f;
+    return walk(t, z, &f);
+}
+
+// How much further apart than they end up the tiles along the way in within()
+// can be. Paths from the origin that end near each other stay near each other
+// all the way out.
+#define WITHIN_SLACK 4.
+
+// Put the tiles on the way from a and b to the origin in *as and *bs, and set
+// *i and *j to where those paths part: as[*i] and bs[*j] are the same tile, and
+// as[*i - 1] and bs[*j - 1], if there are any, are not.
+static void part(tile *a, tile *b, vector<tile *> *as, vector<tile *> *bs,
+        size_t *i, size_t *j)
+{
+    for (tile *t = a; t != NULL; t = t->kind == ORIGIN? NULL : t->nb[0])
+        as->push_back(t);
+    for (tile *t = b; t != NULL; t = t->kind == ORIGIN? NULL : t->nb[0])
+        bs->push_back(t);
+    *i = as->size() - 1;
+    *j = bs->size() - 1;
+    while (*i > 0 && *j > 0 && (*as)[*i - 1] == (*bs)[*j - 1]) {
+        --*i;
+        --*j;
+    }
+}
+
+// Whether b's centre is no further than r from a's, and if so, set *f to the
+// transform that carries b-local coordinates to a-local coordinates.
+//
+// The transform is only ever composed along a short path between the two,
+// found afresh at each step out from where their paths from the origin part,
+// and then only from the exact transforms across each edge of that path, so
+// errors don't build up on the way out.
+bool within(tile *a, tile *b, double r, mobius *f)
+{
+    vector<tile *> as, bs;
+    size_t i, j;
+    part(a, b, &as, &bs, &i, &j);
+    *f = poincare::identity();
+    while (i > 0 || j > 0) {
+        // Step out a ring on the way to each, from *f, which is between where
+        // the last step got to, and find roughly where the next ones are
+        // relative to each other. Then walk from one to the other, to make
+        // *f again.
+        mobius g = *f;
+        tile *x = as[i], *y = bs[j];
+        if (i > 0) {
+            x = as[--i];
+            g = compose(step(0, x->back[0]), g);
+        }
+        if (j > 0) {
+            y = bs[--j];
+            g = compose(g, step(y->back[0], 0));
+        }
+        complex<double> z = image(g, complex<double>(0));
+        if (2*atanh(abs(z)) > r + WITHIN_SLACK)
+            return false;
+        // If g is so far off that the walk ends up somewhere else, g is
+        // still between x and y, if less precisely, so go by that.
+        if (walk(x, &z, f) != y)
+            *f = g;
+    }
+    return 2*atanh(abs(image(*f, complex<double>(0)))) <= r;
+}
+// Carries b-local coordinates to a-local coordinates. This is only quick for
+// tiles near each other.
+mobius relative(tile *a, tile *b)
+{
+    mobius f;
+    if (within(a, b, INFINITY, &f))
+        return f;
+    // With r infinite, that only happens if the transform came out as NaN.
+    // Compose it along the paths from where they part instead, however
+    // imprecise that is.
+    vector<tile *> as, bs;
+    size_t i, j;
+    part(a, b, &as, &bs, &i, &j);
+    f = poincare::identity();
+    for (; i > 0; i--)
+        f = compose(step(0, as[i - 1]->back[0]), f);
+    for (; j > 0; j--)
+        f = compose(f, step(bs[j - 1]->back[0], 0));
+    return f;
+}
+
+static void ink(tile *t)
+{
+    if (!t->inked) {
+        // First time anything has been drawn here.
+        g_inked.push_back(t);
+        t->inked = true;
+    }
+}
+
+// Point t's curves at its own vectors again, after they may have moved.
+static void sync(tile *t)
+{
+    t->points = t->own_points.data();
+    t->starts = t->own_starts.data();
+}
+// Make sure t's curves live in its own vectors, so that they can be changed.
+// A tile that has never had a curve gets its one starts entry here; a mapped
+// tile gets copied.
+static void own(tile *t)
+{
+    if (t->starts == NULL) {
+        t->own_starts.assign(1, 0);
+    } else if (t->starts != t->own_starts.data()) {
+        unsigned n = t->ncurves + t->nundone;
+        t->own_starts.assign(t->starts, t->starts + n + 1);
+        t->own_points.assign(t->points, t->points + t->starts[n]);
+        t->mapping.reset();
+    }
+    sync(t);
+}
+
+// Grow d just enough to take in z.
+static void extend(disc *d, complex<float> z)
+{
+    if (d->r < 0) {
+        *d = {z, 0};
+        return;
+    }
+    float dist = abs(z - d->c);
+    if (dist <= d->r)
+        return;
+    float r = (d->r + dist)/2;
+    d->c += (z - d->c)*((r - d->r)/dist);
+    d->r = r;
+}
+// The square of the index's grid that x, y is in, along one axis.
+static int cell(float x)
+{
+    return (int)floorf(x/CELL_SIZE);
+}
+static uint64_t cell_key(int x, int y)
+{
+    return (uint64_t)(uint32_t)x << 32 | (uint32_t)y;
+}
+// Put block b in every square that the box around p and q goes through.
+static void index_segment(tile *t, unsigned b, complex<float> p,
+        complex<float> q)
+{
+    int x1 = cell(max(real(p), real(q))), y1 = cell(max(imag(p), imag(q)));
+    for (int x = cell(min(real(p), real(q))); x <= x1; x++) {
+        for (int y = cell(min(imag(p), imag(q))); y <= y1; y++) {
+            vector<unsigned> &v = t->cells[cell_key(x, y)];
+            // A block's segments are put in one after the other, so this
+            // catches most of the times it goes through a square twice.
+            if (v.empty() || v.back() != b)
+                v.push_back(b);
+        }
+    }
+}
+// Renumber every block b in t's grid to to[b], or take it out if that is
+// NO_BLOCK.
+#define NO_BLOCK UINT_MAX
+static void renumber_blocks(tile *t, const vector<unsigned> &to)
+{
+    for (auto it = t->cells.begin(); it != t->cells.end();) {
+        vector<unsigned> &v = it->second;
+        unsigned n = 0;
+        for (unsigned b : v) {
+            if (to[b] != NO_BLOCK)
+                v[n++] = to[b];
+        }
+        v.resize(n);
+        if (v.empty())
+            it = t->cells.erase(it);
+        else
+            it++;
+    }
+}
+
+// Add a new curve to the end of t's index.
+static void index_curve(tile *t)
+{
+    t->block_starts.push_back(t->block_starts.back());
+}
+// Add point i to t's index. It is the last point so far of curve c, which is
+// the last curve in the index.
+static void index_point(tile *t, unsigned c, unsigned i)
+{
+    complex<float> z = t->points[i];
+    // Block b is around the segments that start at points BLOCK_SEGMENTS*b up
+    // to BLOCK_SEGMENTS*(b + 1), so the point at the start of one block is at
+    // the end of the one before.
+    unsigned j = i - t->starts[c], b = t->block_starts[c] + j/BLOCK_SEGMENTS;
+    if (b == t->blocks.size()) {
+        t->blocks.push_back({0, -1});
+        t->block_starts[c + 1]++;
+    }
+    extend(&t->blocks[b], z);
+    if (j == 0) {
+        index_segment(t, b, z, z);
+    } else {
+        if (j % BLOCK_SEGMENTS == 0)
+            extend(&t->blocks[--b], z);
+        index_segment(t, b, t->points[i - 1], z);
+    }
+}
+// Make t's index, if it hasn't been made yet.
+static void index(tile *t)
+{
+    if (t->indexed)
+        return;
+    t->blocks.clear();
+    t->block_starts.assign(1, 0);
+    t->cells.clear();
+    for (unsigned c = 0; c < t->ncurves + t->nundone; c++) {
+        index_curve(t);
+        for (unsigned i = t->starts[c]; i < t->starts[c + 1]; i++)
+            index_point(t, c, i);
+    }
+    t->indexed = true;
+}
+
+// Start a new, empty curve in t. This is the end of any curves that were
+// undone in t.
+void new_curve(tile *t)
+{
+    ink(t);
+    drop_undone(t);
+    own(t);
+    t->own_starts.push_back(t->own_starts.back());
+    t->ncurves++;
+    t->version++;
+    sync(t);
+    if (t->indexed)
+        index_curve(t);
+}
+// Add z, in t-local coordinates, to the end of t's last curve.
+void add_point(tile *t, complex<float> z)
+{
+    assert(t->nundone == 0);
+    own(t);
+    t->own_points.push_back(z);
+    t->own_starts.back()++;
+    t->version++;
+    sync(t);
+    if (t->indexed)
+        index_point(t, t->ncurves - 1, t->starts[t->ncurves] - 1);
+    float r = 2*atanh(abs(z));
+    if (r > t->radius)
+        t->radius = r;
+}
+// Move the last point of t's last curve to z, in t-local coordinates.
+void move_point(tile *t, complex<float> z)
+{
+    assert(t->nundone == 0 && t->ncurves > 0 &&
+            t->starts[t->ncurves] > t->starts[t->ncurves - 1]);
+    own(t);
+    t->own_points.back() = z;
+    t->version++;
+    // The index only ever grows, so it still covers where the point was,
+    // which does no harm.
+    if (t->indexed)
+        index_point(t, t->ncurves - 1, t->starts[t->ncurves] - 1);
+    float r = 2*atanh(abs(z));
+    if (r > t->radius)
+        t->radius = r;
+}
+// Undo t's last curve. It stays where it is, after the others, so that it
+// can be redone.
+void pop_curve(tile *t)
+{
+    assert(t->ncurves > 0);
+    t->ncurves--;
+    t->nundone++;
+    t->version++;
+}
+// Redo the last curve undone in t.
+void redo_curve(tile *t)
+{
+    assert(t->nundone > 0);
+    t->ncurves++;
+    t->nundone--;
+    t->version++;
+}
+// Forget the curves undone in t, so that they can never be redone.
+void drop_undone(tile *t)
+{
+    if (t->nundone == 0)
+        return;
+    own(t);
+    t->own_starts.resize(t->ncurves + 1);
+    t->own_points.resize(t->own_starts.back());
+    t->nundone = 0;
+    sync(t);
+    if (t->indexed) {
+        vector<unsigned> to(t->blocks.size(), NO_BLOCK);
+        for (unsigned b = 0; b < t->block_starts[t->ncurves]; b++)
+            to[b] = b;
+        renumber_blocks(t, to);
+        t->blocks.resize(t->block_starts[t->ncurves]);
+        t->block_starts.resize(t->ncurves + 1);
+    }
+}
+// Remove t's curves cs, none of which have been undone, for good. cs has to
+// be in order. The curves after each move down to fill the gap, and it all
+// takes time in proportion to what is in t, however many are removed.
+void remove_curves(tile *t, const vector<unsigned> &cs)
+{
+    if (cs.empty())
+        return;
+    assert(cs.back() < t->ncurves);
+    own(t);
+    vector<unsigned> to(t->blocks.size(), NO_BLOCK);
+    unsigned c = 0, k = 0, np = 0, nb = 0;
+    for (unsigned i = 0; i < t->ncurves + t->nundone; i++) {
+        if (k < cs.size() && cs[k] == i) {
+            k++;
+            continue;
+        }
+        // Move curve i down to be curve c.
+        unsigned first = t->own_starts[i], end = t->own_starts[i + 1];
+        copy(t->own_points.begin() + first, t->own_points.begin() + end,
+                t->own_points.begin() + np);
+        t->own_starts[c] = np;
+        np += end - first;
+        if (t->indexed) {
+            unsigned b0 = t->block_starts[i], b1 = t->block_starts[i + 1];
+            t->block_starts[c] = nb;
+            for (unsigned b = b0; b < b1; b++) {
+                t->blocks[nb] = t->blocks[b];
+                to[b] = nb++;
+            }
+        }
+        c++;
+    }
+    t->own_starts[c] = np;
+    t->own_starts.resize(c + 1);
+    t->own_points.resize(np);
+    t->ncurves -= cs.size();
+    t->version++;
+    sync(t);
+    if (t->indexed) {
+        t->block_starts[c] = nb;
+        t->block_starts.resize(c + 1);
+        t->blocks.resize(nb);
+        renumber_blocks(t, to);
+    }
+}
+
+// The square of the distance from p to the segment ab. This is what gets
+// called in the inner loops, and norm() is a lot cheaper than abs().
+static float distance2(complex<float> p, complex<float> a, complex<float> b)
+{
+    complex<float> u = b - a;
+    float l = norm(u);
+    if (l == 0)
+        return norm(p - a);
+    float s = real((p - a)*conj(u))/l;
+    s = s < 0? 0 : s > 1? 1 : s;
+    return norm(p - (a + s*u));
+}
+// The distance from p to the segment ab.
+static float distance(complex<float> p, complex<float> a, complex<float> b)
+{
+    return sqrtf(distance2(p, a, b));
+}
+// The distance between the segments ab and cd.
+static float distance(complex<float> a, complex<float> b, complex<float> c,
+        complex<float> d)
+{
+    // Which side of each segment the ends of the other are on. If they are on
+    // opposite sides both ways round, the segments cross.
+    auto side = [](complex<float> p, complex<float> q, complex<float> r) {
+        return imag(conj(q - p)*(r - p));
+    };
+    float ac = side(a, b, c), ad = side(a, b, d);
+    float ca = side(c, d, a), cb = side(c, d, b);
+    if (((ac < 0 && ad > 0) || (ac > 0 && ad < 0)) &&
+            ((ca < 0 && cb > 0) || (ca > 0 && cb < 0)))
+        return 0;
+    return min(min(distance(a, c, d), distance(b, c, d)),
+            min(distance(c, a, b), distance(d, a, b)));
+}
+static bool near(const disc &k, complex<float> a, complex<float> b, float d)
+{
+    return k.r >= 0 && distance(k.c, a, b) <= k.r + d;
+}
+
+// Find every curve of t, not counting undone ones, that comes within d of the
+// segment ab, in t-local coordinates, and append their numbers to hits, in
+// order. Only the blocks in the squares of the grid around ab are looked at,
+// so this takes time in proportion to how much is drawn near ab, and not to
+// how much is drawn in t.
+void curves_near(tile *t, complex<float> a, complex<float> b, float d,
+        vector<unsigned> *hits)
+{
+    if (t->ncurves == 0 || !near({0, tanh(t->radius/2)}, a, b, d))
+        return;
+    index(t);
+
+    static vector<unsigned> ks;
+    ks.clear();
+    int x0 = cell(min(real(a), real(b)) - d);
+    int x1 = cell(max(real(a), real(b)) + d);
+    int y0 = cell(min(imag(a), imag(b)) - d);
+    int y1 = cell(max(imag(a), imag(b)) + d);
+    if ((uint64_t)(x1 - x0 + 1)*(y1 - y0 + 1) > t->cells.size()) {
+        // ab goes through more squares than there are in the grid, so just
+        // look at every block.
+        for (auto &square : t->cells)
+            ks.insert(ks.end(), square.second.begin(),
+                    square.second.end());
+    } else {
+        for (int x = x0; x <= x1; x++) {
+            for (int y = y0; y <= y1; y++) {
+                auto it = t->cells.find(cell_key(x, y));
+                if (it != t->cells.end())
+                    ks.insert(ks.end(), it->second.begin(), it->second.end());
+            }
+        }
+    }
+    sort(ks.begin(), ks.end());
+    ks.erase(unique(ks.begin(), ks.end()), ks.end());
+
+    unsigned c = 0;
+    bool hit = false;
+    for (unsigned k : ks) {
+        // The blocks are in order, so the curves they're in are too.
+        while (t->block_starts[c + 1] <= k) {
+            c++;
+            hit = false;
+        }
+        if (c >= t->ncurves)
+            break;
+        if (hit || !near(t->blocks[k], a, b, d))
+            continue;
+        unsigned first = t->starts[c], last = t->starts[c + 1] - 1;
+        unsigned i = first + (k - t->block_starts[c])*BLOCK_SEGMENTS;
+        unsigned end = min(i + BLOCK_SEGMENTS, last);
+        hit = first == last && distance(t->points[first], a, b) <= d;
+        for (; !hit && i < end; i++)
+            hit = distance(a, b, t->points[i], t->points[i + 1]) <= d;
+        if (hit)
+            hits->push_back(c);
+    }
+}
+
+// Cut out of curve whatever is inside d, and append the pieces left over to
+// pieces. Where a piece was cut, it ends on d's edge. Return false if curve
+// doesn't go into d, in which case nothing is appended.
+//
+// Cuts that only graze d are ignored, so that clipping again with the same d
+// does nothing, even though the ends of the pieces are only on its edge give
+// or take a rounding error.
+static bool clip(const complex<float> *curve, unsigned n, disc d,
+        vector<vector<complex<float>>> *pieces)
+{
+    auto inside = [&](complex<float> z) {
+        return abs(z - d.c) < d.r*(1 - 1e-4f);
+    };
+
+    // Walk along the curve, starting a piece wherever it comes out of d, and
+    // ending one wherever it goes in.
+    unsigned n0 = pieces->size();
+    vector<complex<float>> piece;
+    bool cut = false;
+    if (n == 1)
+        cut = inside(curve[0]);
+    else if (!inside(curve[0]))
+        piece.push_back(curve[0]);
+    for (unsigned j = 0; j + 1 < n; j++) {
+        // The part of the segment from p to q that is inside d is from s0 to
+        // s1 of the way along it, if any, where |p + s(q - p) - c| = r.
+        complex<float> p = curve[j], q = curve[j + 1], u = q - p;
+        float a = norm(u), b = real((p - d.c)*conj(u));
+        float det = b*b - a*(norm(p - d.c) - d.r*d.r);
+        float s0 = 1, s1 = 1;
+        if (a > 0 && det > 0) {
+            s0 = max((-b - sqrt(det))/a, 0.f);
+            s1 = min((-b + sqrt(det))/a, 1.f);
+        }
+        if (!(s0 < s1 && ((s1 - s0)*sqrt(a) > d.r*1e-2f || inside(p) ||
+                        inside(q)))) {
+            if (piece.empty())
+                piece.push_back(p);
+            piece.push_back(q);
+            continue;
+        }
+        cut = true;
+        if (s0 > 0)
+            piece.push_back(p + s0*u);
+        if (piece.size() > 1)
+            pieces->push_back(piece);
+        piece.clear();
+        if (s1 < 1) {
+            piece.push_back(p + s1*u);
+            piece.push_back(q);
+        }
+    }
+    if (piece.size() > 1)
+        pieces->push_back(piece);
+    if (!cut)
+        pieces->resize(n0);
+    return cut;
+}
+// Cut whatever is inside d out of t's curves cs, which have to be in order,
+// and put the pieces left over after t's other curves, as curves of their
+// own, in order. Take the curves that don't go into d out of cs, leaving the
+// ones that were cut, and return false if there aren't any. t mustn't have any
+// undone curves, since the pieces go where they would be.
+bool clip_curves(tile *t, vector<unsigned> *cs, disc d)
+{
+    assert(t->nundone == 0);
+    vector<vector<complex<float>>> pieces;
+    unsigned n = 0;
+    for (unsigned c : *cs) {
+        if (clip(t->points + t->starts[c], t->starts[c + 1] - t->starts[c], d,
+                    &pieces))
+            (*cs)[n++] = c;
+    }
+    cs->resize(n);
+    if (n == 0)
+        return false;
+
+    remove_curves(t, *cs);
+    for (const vector<complex<float>> &piece : pieces) {
+        new_curve(t);
+        for (complex<float> z : piece)
+            add_point(t, z);
+    }
+    return true;
+}
+
+// Set points and starts, laid out as in struct tile, to t's curves, not
+// counting undone ones, simplified so that they stay within tolerance of where
+// they were, in the hyperbolic metric, by Ramer-Douglas-Peucker. Leave out the
+// curves that, drawn width wide, would fit in a disc of radius tolerance
+// altogether.
+void simplify(const tile *t, float tolerance, float width,
+        vector<complex<float>> *points, vector<unsigned> *starts)
+{
+    points->clear();
+    starts->assign(1, 0);
+    vector<bool> keep;
+    vector<pair<unsigned, unsigned>> todo;
+    for (unsigned c = 0; c < t->ncurves; c++) {
+        const complex<float> *curve = t->points + t->starts[c];
+        unsigned n = t->starts[c + 1] - t->starts[c];
+        // A curve near the middle of the tile is about twice as big in the
+        // hyperbolic metric as it is in the disc.
+        disc bound = {0, -1};
+        for (unsigned i = 0; i < n; i++)
+            extend(&bound, curve[i]);
+        if ((2*bound.r + width)/(1 - norm(bound.c)) < tolerance)
+            continue;
+
+        keep.assign(n, false);
+        keep[0] = keep[n - 1] = true;
+        todo.assign(1, {0, n - 1});
+        while (!todo.empty()) {
+            unsigned a = todo.back().first, b = todo.back().second;
+            todo.pop_back();
+            // Keep the point furthest from the segment from a to b, if it is
+            // too far, and look again either side of it. Distances are
+            // compared squared.
+            float worst = tolerance*tolerance;
+            unsigned k = a;
+            for (unsigned i = a + 1; i < b; i++) {
+                float s = 1 - norm(curve[i]);
+                float d = 4*distance2(curve[i], curve[a], curve[b])/(s*s);
+                if (d > worst) {
+                    worst = d;
+                    k = i;
+                }
+            }
+            if (k != a) {
+                keep[k] = true;
+                todo.push_back({a, k});
+                todo.push_back({k, b});
+            }
+        }
+        for (unsigned i = 0; i < n; i++) {
+            if (keep[i])
+                points->push_back(curve[i]);
+        }
+        starts->push_back(points->size());
+    }
+}
+
+// Use the ncurves curves, and nundone undone ones, in points and starts, laid
+// out as in struct tile, as t's curves, without copying them. They have to stay
+// put until the tile is changed, at which point they are copied, and so
+// mapping, if they are in one, is held on to until then.
+void map_curves(tile *t, const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, unsigned nundone, float radius,
+        const shared_ptr<const void> &mapping)
+{
+    ink(t);
+    t->points = points;
+    t->starts = starts;
+    t->ncurves = ncurves;
+    t->nundone = nundone;
+    t->version++;
+    t->indexed = false;
+    t->own_points.clear();
+    t->own_starts.clear();
+    t->mapping = mapping;
+    t->radius = radius;
+}
+
+// Point t's curves at points and starts, in mapping, which hold exactly what
+// its curves do now, laid out the same way, and let go of its own copies, or
+// the mapping they were in. As far as anything made from them goes, nothing
+// has changed.
+void rebase(tile *t, const complex<float> *points, const unsigned *starts,
+        const shared_ptr<const void> &mapping)
+{
+    t->points = points;
+    t->starts = starts;
+    t->mapping = mapping;
+    vector<complex<float>>().swap(t->own_points);
+    vector<unsigned>().swap(t->own_starts);
+}
+
+// Every tile that has ever been drawn in.
+const vector<tile *> &inked(void)
+{
+    return g_inked;
+}
+
+}
@@ -0,0 +1,161 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <complex>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "poincare.hpp"
+
+// Strokes are not stored in disc coordinates, which collapse onto the boundary
+// as soon as you pan a little way away from the origin. Instead, the board is
+// cut up into the tiles of a fixed {TILE_P, TILE_Q} tiling, and every curve is
+// stored in the local frame of the tile its first point landed in, where it is
+// never far from the origin.
+//
+// Nothing is kept in absolute coordinates, which run out of precision a few
+// dozen tiles out from the origin. Instead, the tiles are kept in a tree,
+// grown out from the tile at the origin a ring at a time, and a tile is
+// identified by its path from the origin, which is exact at any distance.
+// Tiles are made as they are needed, and are only ever linked to their
+// neighbours by working out which ones they are, never by comparing positions.
+// The transform between two tiles is composed from the transforms across the
+// edges of a short path between them, so it is as precise for two tiles far
+// from the origin as it is for two near it. See tiles.cpp.
+
+#define TILE_P 3
+#define TILE_Q 7
+
+namespace tiles {
+
+// A GPU buffer of CHUNK_SIZE bytes, holding len points of a tile's
+// foreground. See infiniboard.cpp.
+struct chunk {
+    GLuint vbo;
+    unsigned len;
+};
+// A tile's foreground at a lower level of detail, for when it is small on the
+// screen, as it was when the tile's version was version. It is always made
+// from scratch, so it is in a buffer of its own, of just the right size,
+// rather than in chunks. See infiniboard.cpp.
+struct lod {
+    GLuint vbo;
+    unsigned len, version;
+};
+
+// A disc in tile-local coordinates, which, in the Poincare model, is a
+// hyperbolic disc too. It is empty if r < 0.
+struct disc {
+    complex<float> c;
+    float r;
+};
+// How many segments of a curve each disc of the index goes around, and the
+// width of the squares of the index's grid, in tile-local coordinates. See
+// struct tile.
+#define BLOCK_SEGMENTS 8
+#define CELL_SIZE (1.f/64)
+
+struct tile {
+    // Neighbours across each edge, or NULL until they are looked up, and
+    // which of their edges leads back here. Edge k of a tile is edge k of the
+    // reference polygon, in tile-local coordinates. Edge 0 leads to the tile's
+    // parent in the tree, which is always there, except at the origin.
+    tile *nb[TILE_Q];
+    unsigned char back[TILE_Q];
+    // Where the tile is in the tree; see tiles.cpp.
+    unsigned char kind;
+
+    // The curves, in tile-local coordinates. Curve i is made of the points
+    // from points[starts[i]] up to points[starts[i + 1]]. These point into
+    // own_points and own_starts, or, for a tile loaded from a board file that
+    // hasn't been changed since, straight into the file's mapping, which
+    // mapping then keeps mapped. See board.cpp. Don't hold on to them across
+    // changes to the tile.
+    //
+    // After the ncurves curves, there are nundone more, which have been undone
+    // and may yet be redone, so starts has ncurves + nundone + 1 entries.
+    const complex<float> *points;
+    const unsigned *starts;
+    unsigned ncurves, nundone;
+    vector<complex<float>> own_points;
+    vector<unsigned> own_starts;
+    shared_ptr<const void> mapping;
+    // A hyperbolic radius about the tile's centre that contains every point
+    // of every curve.
+    float radius;
+    // Goes up every time the curves change, undoing and redoing included, so
+    // that anything made from them can tell when it is out of date. Never 0
+    // once the tile has any curves.
+    unsigned version;
+    // Whether the tile is in inked().
+    bool inked;
+
+    // An index of where the curves are, for finding the ones near a point
+    // without looking at all of them. Every curve is cut into blocks of
+    // BLOCK_SEGMENTS segments, with a disc around each; the blocks of curve i
+    // are blocks[block_starts[i]] up to blocks[block_starts[i + 1]]. cells
+    // holds, for each square of a grid of CELL_SIZE squares that any curve
+    // goes through, the blocks that go through it. It is only made once it is
+    // needed, and kept up to date from then on.
+    bool indexed;
+    vector<disc> blocks;
+    vector<unsigned> block_starts;
+    unordered_map<uint64_t, vector<unsigned>> cells;
+
+    // Foreground data, as kept by infiniboard.cpp's input thread: how many
+    // points are in each of the chunks it is in, and where in them each curve
+    // ends, as the number of the chunk and the number of points of it. See
+    // tessellate_chunks().
+    // Undone curves are still in the chunks, they just aren't drawn, and so
+    // are erased ones, which have been turned into separators; dead is how
+    // many points of them there are. Then the version of the tile that each
+    // lower level of detail was last made from, and the version it was at
+    // the last time they were looked at.
+    vector<unsigned> lens;
+    vector<pair<unsigned, unsigned>> ends;
+    unsigned dead;
+    vector<unsigned> lod_versions;
+    unsigned seen_version;
+    // And as kept by its render thread, from what the input thread hands it
+    // (see input.hpp): the chunks, how much of them is drawn, and the
+    // foreground at each lower level of detail, made as it is needed, along
+    // with the version and radius of the tile, as of the last update.
+    vector<chunk> chunks;
+    pair<unsigned, unsigned> extent;
+    vector<lod> lods;
+    unsigned shown_version;
+    float shown_radius;
+};
+
+tile *origin(void);
+tile *find(const uint8_t *path, size_t n);
+void path(const tile *t, vector<uint8_t> *p);
+tile *neighbour(tile *t, unsigned k);
+tile *locate(tile *t, complex<double> *z);
+bool within(tile *a, tile *b, double r, poincare::mobius *f);
+poincare::mobius relative(tile *a, tile *b);
+void new_curve(tile *t);
+void add_point(tile *t, complex<float> z);
+void move_point(tile *t, complex<float> z);
+void pop_curve(tile *t);
+void redo_curve(tile *t);
+void drop_undone(tile *t);
+void remove_curves(tile *t, const vector<unsigned> &cs);
+void curves_near(tile *t, complex<float> a, complex<float> b, float d,
+        vector<unsigned> *hits);
+bool clip_curves(tile *t, vector<unsigned> *cs, disc d);
+void simplify(const tile *t, float tolerance, float width,
+        vector<complex<float>> *points, vector<unsigned> *starts);
+void map_curves(tile *t, const complex<float> *points, const unsigned *starts,
+        unsigned ncurves, unsigned nundone, float radius,
+        const shared_ptr<const void> &mapping);
+void rebase(tile *t, const complex<float> *points, const unsigned *starts,
+        const shared_ptr<const void> &mapping);
+const vector<tile *> &inked(void);
+
+}
@@ -0,0 +1,140 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "helpers.hpp"
+
+#include "poincare.hpp"
+#include "tiles.hpp"
+
+using namespace std;
+
+// Check that the tree of tiles is the tiling: that near the origin, where
+// composing transforms all the way out is still precise enough to go by,
+// every tile is where its neighbours say it is, no two tiles are in the same
+// place, and the rings are as big as they should be. Then check that paths
+// lead back to the tiles they came from, and that hundreds of rings out, the
+// transforms between nearby tiles are as precise as they are at the origin.
+
+#define RINGS 7
+
+using poincare::mobius;
+
+static complex<double> centre(const mobius &f)
+{
+    return image(f, complex<double>(0));
+}
+
+// Carries t-local coordinates to the origin's, composed along t's path.
+static mobius absolute(tiles::tile *t)
+{
+    vector<uint8_t> p;
+    tiles::path(t, &p);
+    tiles::tile *u = tiles::origin();
+    mobius f = poincare::identity();
+    for (uint8_t k : p) {
+        tiles::tile *v = tiles::neighbour(u, k);
+        f = compose(f, tiles::relative(u, v));
+        u = v;
+    }
+    return f;
+}
+
+static tiles::tile *wander(tiles::tile *t, unsigned n)
+{
+    for (unsigned i = 0; i < n; i++)
+        t = tiles::neighbour(t, rand() % TILE_Q);
+    return t;
+}
+
+int main(int argc, const char **argv)
+{
+    srand(1);
+
+    // The rings out to RINGS, looking up every neighbour of every tile in
+    // them, in an order that has nothing to do with the tree.
+    vector<vector<tiles::tile *>> rings = {{tiles::origin()}};
+    map<tiles::tile *, unsigned> ring = {{tiles::origin(), 0}};
+    for (unsigned n = 0; n < RINGS; n++) {
+        vector<tiles::tile *> next;
+        vector<tiles::tile *> todo = rings[n];
+        for (unsigned i = 1; i < todo.size(); i++)
+            swap(todo[i], todo[rand() % (i + 1)]);
+        for (tiles::tile *t : todo) {
+            for (unsigned k = 0; k < TILE_Q; k++) {
+                tiles::tile *u = tiles::neighbour(t, k);
+                if (ring.insert({u, n + 1}).second)
+                    next.push_back(u);
+            }
+        }
+        rings.push_back(next);
+    }
+    map<pair<long long, long long>, tiles::tile *> places;
+    for (unsigned n = 0; n <= RINGS; n++) {
+        printf("ring %u: %zu tiles\n", n, rings[n].size());
+        for (tiles::tile *t : rings[n]) {
+            mobius f = absolute(t);
+            for (unsigned k = 0; k < TILE_Q; k++) {
+                tiles::tile *u = t->nb[k];
+                if (u == NULL)
+                    continue;
+                assert(u->nb[t->back[k]] == t && u->back[t->back[k]] == k);
+                mobius g = compose(f, tiles::relative(t, u));
+                mobius h = absolute(u);
+                complex<double> z(.3, .2);
+                assert(abs(centre(g) - centre(h)) < 1e-6 &&
+                        abs(image(g, z) - image(h, z)) < 1e-6);
+            }
+            // Centres are more than a unit apart, measured like this.
+            complex<double> c = centre(f)/(1 - norm(centre(f)));
+            pair<long long, long long> key(llround(real(c)*4),
+                    llround(imag(c)*4));
+            assert(places.insert({key, t}).second);
+        }
+    }
+    // Each ring is about 2.6 times as big as the one before.
+    unsigned sizes[] = {1, 7, 21, 56, 147, 385, 1008, 2639};
+    for (unsigned n = 0; n <= RINGS; n++)
+        assert(rings[n].size() == sizes[n]);
+
+    // Paths lead back where they came from, and nowhere else.
+    for (unsigned i = 0; i < 1000; i++) {
+        tiles::tile *t = wander(tiles::origin(), 30);
+        vector<uint8_t> p;
+        tiles::path(t, &p);
+        assert(tiles::find(p.data(), p.size()) == t);
+    }
+    uint8_t nowhere[] = {0, 0};
+    assert(tiles::find(nowhere, 2) == NULL);
+
+    // Far out, the transform between two tiles is as precise as the
+    // transforms across the edges between them.
+    tiles::tile *far = tiles::origin();
+    for (unsigned i = 0; i < 300; i++)
+        far = tiles::neighbour(far, 3 + rand() % 2);
+    double worst = 0;
+    for (unsigned i = 0; i < 1000; i++) {
+        tiles::tile *a = wander(far, 10), *b = a;
+        mobius g = poincare::identity();
+        for (unsigned n = rand() % 8; n > 0; n--) {
+            tiles::tile *c = wander(b, 1);
+            g = compose(g, tiles::relative(b, c));
+            b = c;
+        }
+        mobius f;
+        bool found = tiles::within(a, b, 2*atanh(abs(centre(g))) + 1e-9, &f);
+        assert(found);
+        // How far apart they are, in the hyperbolic metric.
+        complex<double> z(.3, .2), w = image(g, z);
+        worst = max(worst, 2*abs(image(f, z) - w)/(1 - norm(w)));
+    }
+    printf("300 rings out: off by at most %.3g\n", worst);
+    assert(worst < 1e-12);
+    return 0;
+}
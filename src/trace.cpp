@@ -0,0 +1,195 @@
+// vi:fo=qacj com=b\://
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLFW/glfw3.h>
+
+#include "trace.hpp"
+
+
+namespace trace {
+
+// A trace file is a header followed by the events, one after another. Each
+// event is a byte for its kind and a double for its time, followed by:
+//  KEY:    int32 key, int32 scancode, uint8 action, uint8 mods
+//  CURSOR: double x, double y
+//  BUTTON: uint8 button, uint8 action, uint8 mods, double x, double y
+// all in native byte order.
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    double T;  // the frame period it was recorded at
+};
+#define TRACE_MAGIC "ibtrace"
+#define TRACE_VERSION 1
+
+static FILE *g_recording = NULL;
+static double g_t0;  // glfwGetTime() at the start of the recording
+
+static FILE *g_replaying = NULL;
+// The next event, if it has been read already.
+static bool g_have_next = false;
+static event g_next;
+static bool g_finished = false;
+
+
+template<typename T> static void put(T x)
+{
+    fwrite(&x, sizeof(x), 1, g_recording);
+}
+template<typename T> static bool get(T *x)
+{
+    return fread(x, sizeof(*x), 1, g_replaying) == 1;
+}
+
+// Start recording to fn, for a display with a frame period of T.
+bool record(const char *fn, double T)
+{
+    assert(g_recording == NULL && g_replaying == NULL);
+    g_recording = fopen(fn, "wb");
+    if (g_recording == NULL)
+        return false;
+    trace_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version = TRACE_VERSION;
+    h.T = T;
+    put(h);
+    g_t0 = glfwGetTime();
+    return true;
+}
+
+static void put_start(kind k)
+{
+    put((uint8_t)k);
+    put(glfwGetTime() - g_t0);
+}
+void record_key(int key, int scancode, int action, int mods)
+{
+    if (g_recording == NULL)
+        return;
+    put_start(KEY);
+    put((int32_t)key);
+    put((int32_t)scancode);
+    put((uint8_t)action);
+    put((uint8_t)mods);
+}
+void record_cursor(double x, double y)
+{
+    if (g_recording == NULL)
+        return;
+    put_start(CURSOR);
+    put(x);
+    put(y);
+}
+void record_button(GLFWwindow *window, int button, int action, int mods)
+{
+    if (g_recording == NULL)
+        return;
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    put_start(BUTTON);
+    put((uint8_t)button);
+    put((uint8_t)action);
+    put((uint8_t)mods);
+    put(x);
+    put(y);
+}
+
+
+// Start replaying fn. Set *pT to the frame period it was recorded at.
+bool replay(const char *fn, double *pT)
+{
+    assert(g_recording == NULL && g_replaying == NULL);
+    g_replaying = fopen(fn, "rb");
+    if (g_replaying == NULL)
+        return false;
+    trace_header h;
+    if (!get(&h) || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != TRACE_VERSION) {
+        fprintf(stderr, "%s is not a trace file.\n", fn);
+        fclose(g_replaying);
+        g_replaying = NULL;
+        return false;
+    }
+    *pT = h.T;
+    return true;
+}
+
+bool replaying(void)
+{
+    return g_replaying != NULL;
+}
+
+static bool read_event(event *e)
+{
+    uint8_t k, action, mods, button;
+    int32_t key, scancode;
+    if (!get(&k) || !get(&e->t))
+        return false;
+    e->k = (kind)k;
+    switch (e->k) {
+    case KEY:
+        if (!get(&key) || !get(&scancode) || !get(&action) || !get(&mods))
+            return false;
+        e->key = key;
+        e->scancode = scancode;
+        e->action = action;
+        e->mods = mods;
+        return true;
+    case CURSOR:
+        return get(&e->x) && get(&e->y);
+    case BUTTON:
+        if (!get(&button) || !get(&action) || !get(&mods))
+            return false;
+        e->button = button;
+        e->action = action;
+        e->mods = mods;
+        return get(&e->x) && get(&e->y);
+    case REFRESH:
+        break;
+    }
+    return false;
+}
+
+// If the next event of the replay happened before t, put it in *e and return
+// true. Otherwise, including at the end of the trace, return false.
+bool next(double t, event *e)
+{
+    if (!g_have_next) {
+        if (g_replaying == NULL || g_finished)
+            return false;
+        if (!read_event(&g_next)) {
+            g_finished = true;
+            return false;
+        }
+        g_have_next = true;
+    }
+    if (g_next.t >= t)
+        return false;
+    *e = g_next;
+    g_have_next = false;
+    return true;
+}
+
+// Whether the replay has run out of events.
+bool finished(void)
+{
+    return g_finished;
+}
+
+// Finish recording or replaying.
+void close(void)
+{
+    if (g_recording != NULL)
+        fclose(g_recording);
+    if (g_replaying != NULL)
+        fclose(g_replaying);
+    g_recording = g_replaying = NULL;
+}
+
+}
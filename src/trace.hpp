@@ -0,0 +1,43 @@
+// vi:fo=qacj com=b\://
+
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+// Recording of the glfw input callbacks to a trace file, and playing them back.
+// Run with --record FILE to record a session, and with --replay FILE to feed it
+// back through the same event handlers, with no display, as fast as it will
+// go. The events are replayed frame by frame as they were timestamped, not as
+// fast as they were recorded, so a replay always draws the same frames.
+
+namespace trace {
+
+enum kind {
+    KEY,
+    CURSOR,
+    BUTTON,
+    REFRESH,  // the window needs drawing again; never recorded
+};
+
+struct event {
+    double t;  // seconds since the start of the recording
+    kind k;
+    int key, scancode;  // KEY
+    int button;  // BUTTON
+    int action, mods;  // KEY and BUTTON
+    double x, y;  // CURSOR and BUTTON: where the cursor is
+};
+
+bool record(const char *fn, double T);
+void record_key(int key, int scancode, int action, int mods);
+void record_cursor(double x, double y);
+void record_button(GLFWwindow *window, int button, int action, int mods);
+
+bool replay(const char *fn, double *pT);
+bool replaying(void);
+bool next(double t, event *e);
+bool finished(void);
+
+void close(void);
+
+}